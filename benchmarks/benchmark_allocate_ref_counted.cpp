@@ -0,0 +1,104 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "abu/mem.h"
+
+namespace {
+
+// A request builds a batch of small, linked objects, reads them, and drops
+// all of them at the end.
+struct Payload {
+  abu::mem::ref_count_ptr<Payload> parent;
+  std::array<int, 6> data = {};
+};
+
+struct IntrusivePayload : public abu::mem::ref_counted {
+  abu::mem::ref_count_ptr<IntrusivePayload> parent;
+  std::array<int, 6> data = {};
+};
+
+template <typename T, typename MakeFn>
+void run_request(benchmark::State& state, MakeFn&& make) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+
+  std::vector<abu::mem::ref_count_ptr<T>> objs;
+  objs.reserve(count);
+
+  for (std::size_t i = 0; i < count; ++i) {
+    auto obj = make();
+    if (i != 0) {
+      obj->parent = objs[i / 2];
+    }
+    obj->data[0] = static_cast<int>(i);
+    objs.push_back(std::move(obj));
+  }
+
+  int total = 0;
+  for (const auto& obj : objs) {
+    total += obj->data[0];
+  }
+  benchmark::DoNotOptimize(total);
+}
+
+template <typename T>
+void BM_request_new_delete(benchmark::State& state) {
+  for (auto _ : state) {
+    run_request<T>(state, [] { return abu::mem::make_ref_counted<T>(); });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_request_new_delete, Payload)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_request_new_delete, IntrusivePayload)->Range(16, 4096);
+
+template <typename T>
+void BM_request_pool(benchmark::State& state) {
+  std::pmr::unsynchronized_pool_resource pool;
+
+  for (auto _ : state) {
+    run_request<T>(state, [&] {
+      return abu::mem::allocate_ref_counted<T>(&pool);
+    });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_request_pool, Payload)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_request_pool, IntrusivePayload)->Range(16, 4096);
+
+template <typename T>
+void BM_request_arena(benchmark::State& state) {
+  std::vector<std::byte> buffer(1 << 20);
+
+  for (auto _ : state) {
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+    run_request<T>(state, [&] {
+      return abu::mem::allocate_ref_counted<T>(&arena);
+    });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_request_arena, Payload)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_request_arena, IntrusivePayload)->Range(16, 4096);
+
+template <typename T>
+void BM_request_arena_teardown(benchmark::State& state) {
+  std::vector<std::byte> buffer(1 << 20);
+
+  for (auto _ : state) {
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+    run_request<T>(state, [&] {
+      return abu::mem::allocate_ref_counted<T>(abu::mem::arena_teardown,
+                                               &arena);
+    });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_request_arena_teardown, Payload)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_request_arena_teardown, IntrusivePayload)
+    ->Range(16, 4096);
+}  // namespace
+
+BENCHMARK_MAIN();
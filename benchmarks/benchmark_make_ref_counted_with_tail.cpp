@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "abu/mem.h"
+
+namespace {
+
+// A message whose payload lives in a separate buffer.
+struct Message {
+  explicit Message(std::size_t n) : payload(n) {}
+  std::vector<std::byte> payload;
+};
+
+struct IntrusiveMessage : public abu::mem::ref_counted {
+  explicit IntrusiveMessage(std::size_t n) : payload(n) {}
+  std::vector<std::byte> payload;
+};
+
+// Same, with the payload right after the message.
+struct TailMessage {
+  explicit TailMessage(std::span<std::byte> tail) : payload(tail) {}
+  std::span<std::byte> payload;
+};
+
+struct IntrusiveTailMessage : public abu::mem::ref_counted {
+  explicit IntrusiveTailMessage(std::span<std::byte> tail) : payload(tail) {}
+  std::span<std::byte> payload;
+};
+
+template <typename MakeFn>
+void run_pipeline(benchmark::State& state, MakeFn&& make) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+
+  for (auto _ : state) {
+    auto msg = make(n);
+    msg->payload[0] = std::byte{1};
+    msg->payload[n - 1] = std::byte{2};
+
+    auto shared = msg;
+    benchmark::DoNotOptimize(shared->payload[n / 2]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_message_separate_payload(benchmark::State& state) {
+  run_pipeline(state, [](std::size_t n) {
+    return abu::mem::make_ref_counted<Message>(n);
+  });
+}
+BENCHMARK(BM_message_separate_payload)->Range(16, 4096);
+
+void BM_message_tail_payload(benchmark::State& state) {
+  run_pipeline(state, [](std::size_t n) {
+    return abu::mem::make_ref_counted_with_tail<TailMessage>(n);
+  });
+}
+BENCHMARK(BM_message_tail_payload)->Range(16, 4096);
+
+void BM_intrusive_message_separate_payload(benchmark::State& state) {
+  run_pipeline(state, [](std::size_t n) {
+    return abu::mem::make_ref_counted<IntrusiveMessage>(n);
+  });
+}
+BENCHMARK(BM_intrusive_message_separate_payload)->Range(16, 4096);
+
+void BM_intrusive_message_tail_payload(benchmark::State& state) {
+  run_pipeline(state, [](std::size_t n) {
+    return abu::mem::make_ref_counted_with_tail<IntrusiveTailMessage>(n);
+  });
+}
+BENCHMARK(BM_intrusive_message_tail_payload)->Range(16, 4096);
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,108 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "abu/mem.h"
+
+namespace {
+
+using key_type = std::uint64_t;
+
+key_type key_of(std::int64_t i) {
+  return static_cast<key_type>(i) * 0x9E3779B97F4A7C15ULL;
+}
+
+abu::mem::persistent_map<key_type, std::int64_t> make_persistent(
+    std::int64_t n) {
+  abu::mem::persistent_map<key_type, std::int64_t> result;
+  for (std::int64_t i = 0; i < n; ++i) {
+    result.insert_or_assign(key_of(i), i);
+  }
+  return result;
+}
+
+std::unordered_map<key_type, std::int64_t> make_standard(std::int64_t n) {
+  std::unordered_map<key_type, std::int64_t> result;
+  for (std::int64_t i = 0; i < n; ++i) {
+    result.emplace(key_of(i), i);
+  }
+  return result;
+}
+
+// Builds a new version with a single change, keeping the previous one.
+void BM_persistent_map_update(benchmark::State& state) {
+  const auto n = state.range(0);
+  auto current = make_persistent(n);
+
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    auto next = current;
+    next.insert_or_assign(key_of(i % n), i);
+    current = std::move(next);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_persistent_map_update)->Range(64, 1 << 16);
+
+void BM_copied_unordered_map_update(benchmark::State& state) {
+  const auto n = state.range(0);
+  auto current = make_standard(n);
+
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    auto next = current;
+    next[key_of(i % n)] = i;
+    current = std::move(next);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_copied_unordered_map_update)->Range(64, 1 << 16);
+
+void BM_persistent_map_lookup(benchmark::State& state) {
+  const auto n = state.range(0);
+  const auto map = make_persistent(n);
+
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(key_of(i % n)));
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_persistent_map_lookup)->Range(64, 1 << 16);
+
+void BM_unordered_map_lookup(benchmark::State& state) {
+  const auto n = state.range(0);
+  const auto map = make_standard(n);
+
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(key_of(i % n)));
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_unordered_map_lookup)->Range(64, 1 << 16);
+
+// Nothing is shared while building, so every change happens in place.
+void BM_persistent_map_build(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(make_persistent(state.range(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_persistent_map_build)->Range(64, 1 << 16);
+
+void BM_unordered_map_build(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(make_standard(state.range(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_unordered_map_build)->Range(64, 1 << 16);
+}  // namespace
+
+BENCHMARK_MAIN();
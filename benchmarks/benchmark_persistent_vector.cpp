@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "abu/mem.h"
+
+namespace {
+
+abu::mem::persistent_vector<std::int64_t> make_persistent(std::int64_t n) {
+  abu::mem::persistent_vector<std::int64_t> result;
+  for (std::int64_t i = 0; i < n; ++i) {
+    result.push_back(i);
+  }
+  return result;
+}
+
+std::vector<std::int64_t> make_standard(std::int64_t n) {
+  std::vector<std::int64_t> result;
+  for (std::int64_t i = 0; i < n; ++i) {
+    result.push_back(i);
+  }
+  return result;
+}
+
+// Builds a new version with a single change, keeping the previous one.
+void BM_persistent_vector_update(benchmark::State& state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  auto current = make_persistent(state.range(0));
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    auto next = current;
+    next.set((i * 7919) % n, static_cast<std::int64_t>(i));
+    current = std::move(next);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_persistent_vector_update)->Range(64, 1 << 20);
+
+void BM_copied_vector_update(benchmark::State& state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  auto current = make_standard(state.range(0));
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    auto next = current;
+    next[(i * 7919) % n] = static_cast<std::int64_t>(i);
+    current = std::move(next);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_copied_vector_update)->Range(64, 1 << 20);
+
+void BM_persistent_vector_lookup(benchmark::State& state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto vec = make_persistent(state.range(0));
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vec[(i * 7919) % n]);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_persistent_vector_lookup)->Range(64, 1 << 20);
+
+void BM_vector_lookup(benchmark::State& state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto vec = make_standard(state.range(0));
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vec[(i * 7919) % n]);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_vector_lookup)->Range(64, 1 << 20);
+
+// Nothing is shared while building, so every change happens in place.
+void BM_persistent_vector_build(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(make_persistent(state.range(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_persistent_vector_build)->Range(64, 1 << 20);
+
+void BM_vector_build(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(make_standard(state.range(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_vector_build)->Range(64, 1 << 20);
+}  // namespace
+
+BENCHMARK_MAIN();
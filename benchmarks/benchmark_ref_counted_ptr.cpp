@@ -1,91 +1,206 @@
-#include <benchmark/benchmark.h>
-
-#include <cstdlib>
-#include <ctime>
-
-#include <memory>
-#include "abu/mem.h"
-
-namespace {
-static void BM_shared_ptr_int_lifetime(benchmark::State& state) {
-  std::srand(std::time(nullptr));
-  int v = std::rand();
-
-  for (auto _ : state) {
-    (void)_;
-    auto tmp = std::make_shared<int>(v);
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_shared_ptr_int_lifetime);
-
-static void BM_shared_ptr_int_access(benchmark::State& state) {
-  std::srand(std::time(nullptr));
-  int v = std::rand();
-
-  for (auto _ : state) {
-    (void)_;
-    auto tmp = std::make_shared<int>(v);
-    int u = *tmp;
-    benchmark::DoNotOptimize(u);
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_shared_ptr_int_access);
-
-static void BM_ref_counted_int_lifetime(benchmark::State& state) {
-  std::srand(std::time(nullptr));
-  int v = std::rand();
-
-  for (auto _ : state) {
-    (void)_;
-    auto tmp = abu::mem::make_ref_counted<int>(v);
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_ref_counted_int_lifetime);
-
-static void BM_ref_counted_int_access(benchmark::State& state) {
-  std::srand(std::time(nullptr));
-  int v = std::rand();
-
-  for (auto _ : state) {
-    (void)_;
-    auto tmp = abu::mem::make_ref_counted<int>(v);
-    int u = *tmp;
-    benchmark::DoNotOptimize(u);
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_ref_counted_int_access);
-
-static void BM_shared_ptr_obj_lifetime(benchmark::State& state) {
-  struct ObjType {};
-  for (auto _ : state) {
-    auto tmp = std::make_shared<ObjType>();
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_shared_ptr_obj_lifetime);
-
-static void BM_ref_counted_obj_lifetime(benchmark::State& state) {
-  struct ObjType {};
-  for (auto _ : state) {
-    auto tmp = abu::mem::make_ref_counted<ObjType>();
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_ref_counted_obj_lifetime);
-
-static void BM_ref_counted_intrusive_obj_lifetime(benchmark::State& state) {
-  struct ObjType : public abu::mem::ref_counted {};
-
-  for (auto _ : state) {
-    auto tmp = abu::mem::make_ref_counted<ObjType>();
-    benchmark::DoNotOptimize(tmp);
-  }
-}
-BENCHMARK(BM_ref_counted_intrusive_obj_lifetime);
-}  // namespace
-
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <ctime>
+
+#include <memory>
+#include <utility>
+#include "abu/mem.h"
+
+namespace {
+static void BM_shared_ptr_int_lifetime(benchmark::State& state) {
+  std::srand(std::time(nullptr));
+  int v = std::rand();
+
+  for (auto _ : state) {
+    (void)_;
+    auto tmp = std::make_shared<int>(v);
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_shared_ptr_int_lifetime);
+
+static void BM_shared_ptr_int_access(benchmark::State& state) {
+  std::srand(std::time(nullptr));
+  int v = std::rand();
+
+  for (auto _ : state) {
+    (void)_;
+    auto tmp = std::make_shared<int>(v);
+    int u = *tmp;
+    benchmark::DoNotOptimize(u);
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_shared_ptr_int_access);
+
+static void BM_ref_counted_int_lifetime(benchmark::State& state) {
+  std::srand(std::time(nullptr));
+  int v = std::rand();
+
+  for (auto _ : state) {
+    (void)_;
+    auto tmp = abu::mem::make_ref_counted<int>(v);
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_int_lifetime);
+
+static void BM_ref_counted_int_access(benchmark::State& state) {
+  std::srand(std::time(nullptr));
+  int v = std::rand();
+
+  for (auto _ : state) {
+    (void)_;
+    auto tmp = abu::mem::make_ref_counted<int>(v);
+    int u = *tmp;
+    benchmark::DoNotOptimize(u);
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_int_access);
+
+static void BM_shared_ptr_obj_lifetime(benchmark::State& state) {
+  struct ObjType {};
+  for (auto _ : state) {
+    auto tmp = std::make_shared<ObjType>();
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_shared_ptr_obj_lifetime);
+
+static void BM_ref_counted_obj_lifetime(benchmark::State& state) {
+  struct ObjType {};
+  for (auto _ : state) {
+    auto tmp = abu::mem::make_ref_counted<ObjType>();
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_obj_lifetime);
+
+static void BM_ref_counted_intrusive_obj_lifetime(benchmark::State& state) {
+  struct ObjType : public abu::mem::ref_counted {};
+
+  for (auto _ : state) {
+    auto tmp = abu::mem::make_ref_counted<ObjType>();
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_intrusive_obj_lifetime);
+
+struct CastBase : public abu::mem::ref_counted {
+  virtual ~CastBase() = default;
+};
+struct CastDerived : public CastBase {
+  int v = 0;
+};
+
+static void BM_ref_counted_downcast_rewrap(benchmark::State& state) {
+  abu::mem::ref_count_ptr<CastBase> base =
+      abu::mem::make_ref_counted<CastDerived>();
+
+  for (auto _ : state) {
+    abu::mem::ref_count_ptr<CastDerived> derived{
+        static_cast<CastDerived*>(base.get())};
+    base.reset();
+    derived->v += 1;
+    base = std::move(derived);
+    benchmark::DoNotOptimize(base);
+  }
+}
+BENCHMARK(BM_ref_counted_downcast_rewrap);
+
+static void BM_ref_counted_downcast_moved(benchmark::State& state) {
+  abu::mem::ref_count_ptr<CastBase> base =
+      abu::mem::make_ref_counted<CastDerived>();
+
+  for (auto _ : state) {
+    auto derived = abu::mem::static_ref_cast<CastDerived>(std::move(base));
+    derived->v += 1;
+    base = std::move(derived);
+    benchmark::DoNotOptimize(base);
+  }
+}
+BENCHMARK(BM_ref_counted_downcast_moved);
+
+static void BM_ref_counted_dynamic_downcast_moved(benchmark::State& state) {
+  abu::mem::ref_count_ptr<CastBase> base =
+      abu::mem::make_ref_counted<CastDerived>();
+
+  for (auto _ : state) {
+    auto derived = abu::mem::dynamic_ref_cast<CastDerived>(std::move(base));
+    derived->v += 1;
+    base = std::move(derived);
+    benchmark::DoNotOptimize(base);
+  }
+}
+BENCHMARK(BM_ref_counted_dynamic_downcast_moved);
+
+static void BM_shared_ptr_dynamic_downcast_moved(benchmark::State& state) {
+  std::shared_ptr<CastBase> base = std::make_shared<CastDerived>();
+
+  for (auto _ : state) {
+    auto derived = std::dynamic_pointer_cast<CastDerived>(std::move(base));
+    derived->v += 1;
+    base = std::move(derived);
+    benchmark::DoNotOptimize(base);
+  }
+}
+BENCHMARK(BM_shared_ptr_dynamic_downcast_moved);
+
+// A legacy object with its own embedded count.
+class HookedObj {
+ public:
+  void add_ref() {
+    count_ += 1;
+  }
+
+  void release() {
+    count_ -= 1;
+    if (count_ == 0) {
+      delete this;
+    }
+  }
+
+  int v = 0;
+
+ private:
+  int count_ = 0;
+};
+
+// Same, without the hooks, so that it needs a separate control block.
+struct UnhookedObj {
+  int v = 0;
+  int count = 0;
+};
+
+static void BM_ref_counted_foreign_hooks_adopt(benchmark::State& state) {
+  for (auto _ : state) {
+    abu::mem::ref_count_ptr<HookedObj> tmp{new HookedObj};
+    tmp->v += 1;
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_foreign_hooks_adopt);
+
+static void BM_ref_counted_control_block_adopt(benchmark::State& state) {
+  for (auto _ : state) {
+    abu::mem::ref_count_ptr<UnhookedObj> tmp{new UnhookedObj};
+    tmp->v += 1;
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_control_block_adopt);
+
+static void BM_ref_counted_foreign_hooks_copy(benchmark::State& state) {
+  auto obj = abu::mem::make_ref_counted<HookedObj>();
+
+  for (auto _ : state) {
+    auto tmp = obj;
+    benchmark::DoNotOptimize(tmp);
+  }
+}
+BENCHMARK(BM_ref_counted_foreign_hooks_copy);
+}  // namespace
+
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "abu/mem.h"
+
+namespace {
+
+// A cluster of small objects, such as a parsed document, that is built and
+// dropped as a whole.
+struct Node : public abu::mem::ref_counted {
+  abu::mem::ref_count_ptr<Node> parent;
+  std::array<int, 6> data = {};
+};
+
+struct RegionNode : public abu::mem::region_allocated {
+  abu::mem::ref_view<RegionNode> parent;
+  std::array<int, 6> data = {};
+};
+
+// Each object links to an earlier one, as a tree of parents.
+template <typename T, typename MakeFn>
+std::vector<abu::mem::ref_count_ptr<T>> build_cluster(std::size_t count,
+                                                      MakeFn&& make) {
+  std::vector<abu::mem::ref_count_ptr<T>> objs;
+  objs.reserve(count);
+
+  for (std::size_t i = 0; i < count; ++i) {
+    auto obj = make();
+    if (i != 0) {
+      obj->parent = objs[i / 2];
+    }
+    obj->data[0] = static_cast<int>(i);
+    objs.push_back(std::move(obj));
+  }
+  return objs;
+}
+
+// Building and dropping a whole cluster.
+void BM_cluster_ref_counted(benchmark::State& state) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+
+  for (auto _ : state) {
+    auto objs = build_cluster<Node>(
+        count, [] { return abu::mem::make_ref_counted<Node>(); });
+    benchmark::DoNotOptimize(objs.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_cluster_ref_counted)->Range(16, 4096);
+
+void BM_cluster_region(benchmark::State& state) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+
+  std::size_t reserved = 0;
+  for (auto _ : state) {
+    abu::mem::ref_region region;
+    auto objs = build_cluster<RegionNode>(
+        count, [&] { return region.make<RegionNode>(); });
+    benchmark::DoNotOptimize(objs.data());
+    reserved = region.reserved_bytes();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["bytes_per_object"] =
+      static_cast<double>(reserved) / static_cast<double>(count);
+}
+BENCHMARK(BM_cluster_region)->Range(16, 4096);
+
+// Only the release of an already built cluster.
+void BM_release_ref_counted(benchmark::State& state) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto objs = build_cluster<Node>(
+        count, [] { return abu::mem::make_ref_counted<Node>(); });
+    state.ResumeTiming();
+
+    objs.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_release_ref_counted)->Range(16, 4096);
+
+void BM_release_region(benchmark::State& state) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<abu::mem::ref_count_ptr<RegionNode>> objs;
+    {
+      abu::mem::ref_region region;
+      objs = build_cluster<RegionNode>(
+          count, [&] { return region.make<RegionNode>(); });
+    }
+    state.ResumeTiming();
+
+    objs.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_release_region)->Range(16, 4096);
+}  // namespace
+
+BENCHMARK_MAIN();
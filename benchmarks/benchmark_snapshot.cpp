@@ -0,0 +1,169 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "abu/mem.h"
+#include "abu/mem/snapshot.h"
+
+namespace {
+struct Payload {
+  std::int64_t id;
+  double weight;
+};
+
+struct Node : public abu::mem::ref_counted {
+  std::int64_t value = 0;
+  abu::mem::ref_count_ptr<Node> left;
+  abu::mem::ref_count_ptr<Node> right;
+  abu::mem::ref_count_ptr<Payload> payload;
+};
+}  // namespace
+
+template <>
+struct abu::mem::snapshot_traits<Node> {
+  static void save(snapshot_writer& w, const Node& n) {
+    w.write(n.value);
+    w.write_ref(n.left);
+    w.write_ref(n.right);
+    w.write_ref(n.payload);
+  }
+
+  static ref_count_ptr<Node> load(snapshot_reader& r) {
+    auto result = make_ref_counted<Node>();
+    result->value = r.read<std::int64_t>();
+    r.read_ref(result->left);
+    r.read_ref(result->right);
+    r.read_ref(result->payload);
+    return result;
+  }
+};
+
+namespace {
+// Balanced tree holding about 2/3 of node_count, where sibling nodes share an
+// in-place payload, which makes up the remaining third.
+abu::mem::ref_count_ptr<Node> make_graph(std::size_t node_count) {
+  std::size_t tree_size = node_count * 2 / 3;
+
+  std::vector<abu::mem::ref_count_ptr<Node>> nodes(tree_size);
+  for (std::size_t i = tree_size; i-- > 0;) {
+    auto node = abu::mem::make_ref_counted<Node>();
+    node->value = static_cast<std::int64_t>(i);
+
+    std::size_t l = 2 * i + 1;
+    if (l < tree_size) {
+      node->left = std::move(nodes[l]);
+    }
+    if (l + 1 < tree_size) {
+      node->right = std::move(nodes[l + 1]);
+    }
+
+    if (i % 2 == 1 && i + 1 < tree_size) {
+      node->payload = nodes[i + 1]->payload;
+    } else {
+      node->payload = abu::mem::make_ref_counted<Payload>(
+          Payload{static_cast<std::int64_t>(i), 1.0});
+    }
+    nodes[i] = std::move(node);
+  }
+  return nodes[0];
+}
+
+// Fixed-size graphs take a while to build, so they are only made once.
+const std::vector<std::byte>& snapshot_of(std::size_t node_count) {
+  static std::size_t cached_count = 0;
+  static std::vector<std::byte> cached;
+
+  if (cached_count != node_count) {
+    cached.clear();
+    cached = abu::mem::save_snapshot(make_graph(node_count));
+    cached_count = node_count;
+  }
+  return cached;
+}
+
+void BM_snapshot_save(benchmark::State& state) {
+  auto graph = make_graph(static_cast<std::size_t>(state.range(0)));
+
+  for (auto _ : state) {
+    auto data = abu::mem::save_snapshot(graph);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_snapshot_save)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+// Baseline: rebuilding the same graph from scratch.
+void BM_snapshot_rebuild_baseline(benchmark::State& state) {
+  for (auto _ : state) {
+    auto graph = make_graph(static_cast<std::size_t>(state.range(0)));
+    benchmark::DoNotOptimize(graph.get());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_snapshot_rebuild_baseline)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_snapshot_load_from_memory(benchmark::State& state) {
+  const auto& data = snapshot_of(static_cast<std::size_t>(state.range(0)));
+
+  for (auto _ : state) {
+    auto snap = abu::mem::snapshot::copy_of(data);
+    auto root = snap.root<Node>();
+    benchmark::DoNotOptimize(root.get());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_snapshot_load_from_memory)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_snapshot_load_mapped(benchmark::State& state) {
+  auto path = std::filesystem::temp_directory_path() /
+              "abu_mem_benchmark_snapshot.bin";
+  abu::mem::save_snapshot(
+      make_graph(static_cast<std::size_t>(state.range(0))), path);
+
+  for (auto _ : state) {
+    auto snap = abu::mem::snapshot::map_file(path);
+    auto root = snap.root<Node>();
+    benchmark::DoNotOptimize(root.get());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_snapshot_load_mapped)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+// Only touches the root: in-place nodes are never materialized.
+void BM_snapshot_map_in_place_root(benchmark::State& state) {
+  auto path = std::filesystem::temp_directory_path() /
+              "abu_mem_benchmark_snapshot_root.bin";
+  abu::mem::save_snapshot(
+      abu::mem::make_ref_counted<Payload>(Payload{1, 2.0}), path);
+
+  for (auto _ : state) {
+    auto snap = abu::mem::snapshot::map_file(path);
+    auto root = snap.root<Payload>();
+    benchmark::DoNotOptimize(root->weight);
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_snapshot_map_in_place_root);
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,115 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "abu/mem.h"
+
+namespace {
+
+// Read-mostly routing table, looked up by every request.
+struct RoutingTable : public abu::mem::ref_counted {
+  std::array<int, 256> routes = {};
+};
+
+abu::mem::ref_count_ptr<RoutingTable> make_table() {
+  auto result = abu::mem::make_ref_counted<RoutingTable>();
+  for (std::size_t i = 0; i < result->routes.size(); ++i) {
+    result->routes[i] = static_cast<int>(i);
+  }
+  return result;
+}
+
+const int max_threads =
+    static_cast<int>(std::max(std::thread::hardware_concurrency(), 1U));
+
+void BM_snapshot_cell_read(benchmark::State& state) {
+  static abu::mem::snapshot_cell<RoutingTable> cell{make_table()};
+
+  std::size_t key = static_cast<std::size_t>(state.thread_index());
+  for (auto _ : state) {
+    auto table = cell.read();
+    benchmark::DoNotOptimize(table->routes[key++ % table->routes.size()]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_snapshot_cell_read)->ThreadRange(1, max_threads)->UseRealTime();
+
+// Same, with a writer publishing a new version every millisecond.
+void BM_snapshot_cell_read_with_writer(benchmark::State& state) {
+  static abu::mem::snapshot_cell<RoutingTable> cell{make_table()};
+  static std::atomic<bool> done;
+  static std::thread writer;
+
+  if (state.thread_index() == 0) {
+    done = false;
+    writer = std::thread([] {
+      while (!done) {
+        cell.publish(make_table());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  std::size_t key = static_cast<std::size_t>(state.thread_index());
+  for (auto _ : state) {
+    auto table = cell.read();
+    benchmark::DoNotOptimize(table->routes[key++ % table->routes.size()]);
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    done = true;
+    writer.join();
+  }
+}
+BENCHMARK(BM_snapshot_cell_read_with_writer)
+    ->ThreadRange(1, max_threads)
+    ->UseRealTime();
+
+// Baseline: a plain ref_count_ptr shared by every thread. Its count is not
+// atomic, so readers take a copy under a lock.
+void BM_shared_ref_count_ptr_read(benchmark::State& state) {
+  static std::mutex mutex;
+  static abu::mem::ref_count_ptr<RoutingTable> shared = make_table();
+
+  std::size_t key = static_cast<std::size_t>(state.thread_index());
+  for (auto _ : state) {
+    abu::mem::ref_count_ptr<RoutingTable> table;
+    {
+      std::lock_guard lock(mutex);
+      table = shared;
+    }
+    benchmark::DoNotOptimize(table->routes[key++ % table->routes.size()]);
+
+    std::lock_guard lock(mutex);
+    table.reset();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_shared_ref_count_ptr_read)
+    ->ThreadRange(1, max_threads)
+    ->UseRealTime();
+
+// Baseline: a single atomic count, as with std::shared_ptr.
+void BM_shared_ptr_read(benchmark::State& state) {
+  static std::shared_ptr<RoutingTable> shared =
+      std::make_shared<RoutingTable>();
+
+  std::size_t key = static_cast<std::size_t>(state.thread_index());
+  for (auto _ : state) {
+    std::shared_ptr<RoutingTable> table = shared;
+    benchmark::DoNotOptimize(table->routes[key++ % table->routes.size()]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_shared_ptr_read)->ThreadRange(1, max_threads)->UseRealTime();
+}  // namespace
+
+BENCHMARK_MAIN();
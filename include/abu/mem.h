@@ -1,24 +1,31 @@
-// Copyright 2021 Francois Chabot
-
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-
-//     http://www.apache.org/licenses/LICENSE-2.0
-
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-#ifndef ABU_MEM_H_INCLUDED
-#define ABU_MEM_H_INCLUDED
-
-#include "abu/base/include_header.h"
-
-#include "abu/mem/ref_count_ptr.h"
-
-#include "abu/base/include_header.h"
-
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_H_INCLUDED
+#define ABU_MEM_H_INCLUDED
+
+#include "abu/base/include_header.h"
+
+#include "abu/mem/allocate_ref_counted.h"
+#include "abu/mem/make_ref_counted_with_tail.h"
+#include "abu/mem/persistent_map.h"
+#include "abu/mem/persistent_vector.h"
+#include "abu/mem/ref_count_ptr.h"
+#include "abu/mem/ref_region.h"
+#include "abu/mem/ref_view.h"
+#include "abu/mem/snapshot_cell.h"
+
+#include "abu/base/include_header.h"
+
 #endif
\ No newline at end of file
@@ -0,0 +1,244 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_ALLOCATE_REF_COUNTED_H_INCLUDED
+#define ABU_MEM_ALLOCATE_REF_COUNTED_H_INCLUDED
+
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+#include "abu/mem/ref_region.h"
+
+namespace abu::mem {
+
+// Tag requesting that the final release of an object skips handing its
+// storage back to the allocator. Meant for arenas that are dropped wholesale.
+struct arena_teardown_t {
+  explicit arena_teardown_t() = default;
+};
+inline constexpr arena_teardown_t arena_teardown{};
+
+template <typename A>
+concept ref_count_allocator =
+    std::convertible_to<A, std::pmr::memory_resource*> || requires(A& a) {
+      typename A::value_type;
+      a.deallocate(a.allocate(1), 1);
+    };
+
+namespace details_ {
+
+struct no_allocator {};
+
+template <typename A>
+auto as_allocator(const A& alloc) {
+  if constexpr (std::convertible_to<A, std::pmr::memory_resource*>) {
+    return std::pmr::polymorphic_allocator<std::byte>(alloc);
+  } else {
+    return alloc;
+  }
+}
+
+template <typename Alloc, typename U>
+using rebound_allocator =
+    typename std::allocator_traits<Alloc>::template rebind_alloc<U>;
+
+// Allocates and constructs Obj, handing the storage back if construction
+// fails.
+template <typename Obj, typename Alloc, typename... Args>
+Obj* allocate_and_construct(Alloc& alloc, Args&&... args) {
+  using traits = std::allocator_traits<Alloc>;
+  auto storage = traits::allocate(alloc, 1);
+  try {
+    return ::new (static_cast<void*>(std::to_address(storage)))
+        Obj(std::forward<Args>(args)...);
+  } catch (...) {
+    traits::deallocate(alloc, storage, 1);
+    throw;
+  }
+}
+
+// Control block and object sharing a single allocation.
+template <typename T, typename Alloc, bool Deallocates>
+struct allocated_shared_state final : basic_shared_state {
+  using allocator_type = rebound_allocator<Alloc, allocated_shared_state>;
+  using stored_allocator_type =
+      std::conditional_t<Deallocates, allocator_type, no_allocator>;
+
+  template <typename... Args>
+  explicit allocated_shared_state(const allocator_type& a, Args&&... args)
+      : alloc(store_(a)), obj(std::forward<Args>(args)...) {
+    ptr = &obj;
+  }
+
+  allocated_shared_state(const allocated_shared_state&) = delete;
+  allocated_shared_state(allocated_shared_state&&) = delete;
+  allocated_shared_state& operator=(const allocated_shared_state&) = delete;
+  allocated_shared_state& operator=(allocated_shared_state&&) = delete;
+  ~allocated_shared_state() = default;
+
+  void dispose() noexcept override {
+    if constexpr (Deallocates) {
+      allocator_type a = std::move(alloc);
+      std::destroy_at(this);
+      std::allocator_traits<allocator_type>::deallocate(a, this, 1);
+    } else {
+      std::destroy_at(this);
+    }
+  }
+
+  [[no_unique_address]] stored_allocator_type alloc;
+  T obj;
+
+ private:
+  static stored_allocator_type store_(const allocator_type& a) noexcept {
+    if constexpr (Deallocates) {
+      return a;
+    } else {
+      return {};
+    }
+  }
+};
+
+// Intrusive objects are their own control block. They are preceded by the
+// allocator needed to release them, and then by their disposal_header.
+template <typename Alloc, bool Deallocates>
+struct allocator_prefix {
+  std::conditional_t<Deallocates, Alloc, no_allocator> alloc;
+};
+
+template <std::size_t Alignment>
+struct alignas(Alignment) allocation_unit {
+  std::byte bytes[Alignment];
+};
+
+template <typename T, typename Alloc, bool Deallocates>
+struct allocated_intrusive {
+  using prefix_type = allocator_prefix<Alloc, Deallocates>;
+  using layout = disposable_layout<prefix_type, T>;
+  using unit_type = allocation_unit<layout::alignment>;
+  using allocator_type = rebound_allocator<Alloc, unit_type>;
+  static constexpr std::size_t unit_count =
+      align_up(layout::size, layout::alignment) / layout::alignment;
+
+  template <typename... Args>
+  static T* create(const Alloc& alloc, Args&&... args) {
+    using traits = std::allocator_traits<allocator_type>;
+
+    allocator_type a(alloc);
+    auto storage = traits::allocate(a, unit_count);
+    std::byte* block =
+        reinterpret_cast<std::byte*>(std::to_address(storage));
+
+    // The prefix goes first, so that a throwing allocator copy leaves no
+    // object behind.
+    prefix_type* prefix = nullptr;
+    try {
+      if constexpr (Deallocates) {
+        prefix = ::new (static_cast<void*>(block)) prefix_type{alloc};
+      } else {
+        prefix = ::new (static_cast<void*>(block)) prefix_type{};
+      }
+      T* obj = ::new (static_cast<void*>(block + layout::object_offset))
+          T(std::forward<Args>(args)...);
+      ::new (static_cast<void*>(block + layout::header_offset))
+          disposal_header{&dispose};
+      return obj;
+    } catch (...) {
+      if (prefix) {
+        std::destroy_at(prefix);
+      }
+      traits::deallocate(a, storage, unit_count);
+      throw;
+    }
+  }
+
+  static void dispose(void* obj) noexcept {
+    std::byte* block = layout::block_of(obj);
+    auto prefix = std::launder(reinterpret_cast<prefix_type*>(block));
+
+    std::destroy_at(static_cast<T*>(obj));
+
+    if constexpr (Deallocates) {
+      using traits = std::allocator_traits<allocator_type>;
+      allocator_type a(std::move(prefix->alloc));
+      std::destroy_at(prefix);
+      traits::deallocate(a,
+                         std::launder(reinterpret_cast<unit_type*>(block)),
+                         unit_count);
+    } else {
+      std::destroy_at(prefix);
+    }
+  }
+};
+
+template <typename T, bool Deallocates, typename A, typename... Args>
+ref_count_ptr<T> allocate_ref_counted_impl(const A& raw_alloc,
+                                           Args&&... args) {
+  static_assert(!std::derived_from<T, region_allocated>,
+                "region_allocated types are created by ref_region::make()");
+  static_assert(!details_::foreign_ref_counted<T>,
+                "types with their own add_ref()/release() manage their own "
+                "storage");
+
+  auto alloc = as_allocator(raw_alloc);
+  using alloc_type = decltype(alloc);
+
+  if constexpr (std::derived_from<T, ref_counted>) {
+    using impl = allocated_intrusive<T, alloc_type, Deallocates>;
+    T* obj = impl::create(alloc, std::forward<Args>(args)...);
+    return ref_count_ptr_access::adopt<T>(
+        ref_counted_access::adopt_with_custom_disposal(obj));
+  } else {
+    using state_type = allocated_shared_state<T, alloc_type, Deallocates>;
+    typename state_type::allocator_type state_alloc(alloc);
+
+    gsl::owner<basic_shared_state*> state =
+        allocate_and_construct<state_type>(
+            state_alloc, state_alloc, std::forward<Args>(args)...);
+    state->ref_count = 1;
+    return ref_count_ptr_access::adopt<T>(state);
+  }
+}
+}  // namespace details_
+
+// Creates a reference-counted T, with its control block, in memory obtained
+// from alloc. alloc is either a standard allocator or a
+// std::pmr::memory_resource*. It is kept alongside the object so that the
+// final release can hand the memory back.
+template <typename T, ref_count_allocator Alloc, typename... Args>
+ref_count_ptr<T> allocate_ref_counted(const Alloc& alloc, Args&&... args) {
+  return details_::allocate_ref_counted_impl<T, true>(
+      alloc, std::forward<Args>(args)...);
+}
+
+// Same as above, but the final release only destroys the object. The memory
+// is reclaimed when the arena backing alloc is dropped.
+template <typename T, ref_count_allocator Alloc, typename... Args>
+ref_count_ptr<T> allocate_ref_counted(arena_teardown_t,
+                                      const Alloc& alloc,
+                                      Args&&... args) {
+  return details_::allocate_ref_counted_impl<T, false>(
+      alloc, std::forward<Args>(args)...);
+}
+
+}  // namespace abu::mem
+
+#endif
@@ -0,0 +1,240 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_MAKE_REF_COUNTED_WITH_TAIL_H_INCLUDED
+#define ABU_MEM_MAKE_REF_COUNTED_WITH_TAIL_H_INCLUDED
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+#include "abu/mem/ref_region.h"
+
+namespace abu::mem {
+
+namespace details_ {
+template <typename T>
+struct tail_element {
+  using type = std::byte;
+};
+
+template <typename T>
+requires requires {
+  typename T::tail_element_type;
+}
+struct tail_element<T> {
+  using type = typename T::tail_element_type;
+};
+
+// Tail element whose lifetime is managed by its owner, for tails that are
+// only partially in use.
+template <typename T>
+union tail_slot {
+  tail_slot() noexcept {}
+  tail_slot(const tail_slot&) = delete;
+  tail_slot(tail_slot&&) = delete;
+  tail_slot& operator=(const tail_slot&) = delete;
+  tail_slot& operator=(tail_slot&&) = delete;
+  ~tail_slot() {}
+
+  T value;
+};
+
+inline void* allocate_block(std::size_t size, std::size_t alignment) {
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return ::operator new(size, std::align_val_t{alignment});
+  }
+  return ::operator new(size);
+}
+
+inline void deallocate_block(void* block,
+                             std::size_t size,
+                             std::size_t alignment) noexcept {
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    ::operator delete(block, size, std::align_val_t{alignment});
+  } else {
+    ::operator delete(block, size);
+  }
+}
+
+// A block made of Head, followed by n elements of type E.
+template <typename Head, typename E>
+struct tail_layout {
+  static constexpr std::size_t alignment =
+      std::max(alignof(Head), alignof(E));
+  static constexpr std::size_t tail_offset =
+      align_up(sizeof(Head), alignof(E));
+
+  static constexpr std::size_t max_tail_size =
+      (std::numeric_limits<std::size_t>::max() - tail_offset) / sizeof(E);
+
+  static std::size_t size(std::size_t n) noexcept {
+    return tail_offset + n * sizeof(E);
+  }
+
+  static E* tail_of(void* block) noexcept {
+    return std::launder(
+        reinterpret_cast<E*>(static_cast<std::byte*>(block) + tail_offset));
+  }
+};
+
+// Default-initializes the tail of a block, then builds its head with
+// make_head(tail). Everything is undone if anything throws.
+template <typename Layout, typename E, typename MakeHead>
+auto construct_with_tail(std::size_t n, MakeHead&& make_head) {
+  if (n > Layout::max_tail_size) {
+    throw std::bad_array_new_length();
+  }
+
+  std::size_t size = Layout::size(n);
+  void* block = allocate_block(size, Layout::alignment);
+  E* tail = Layout::tail_of(block);
+
+  try {
+    std::uninitialized_default_construct_n(tail, n);
+  } catch (...) {
+    deallocate_block(block, size, Layout::alignment);
+    throw;
+  }
+
+  try {
+    return std::forward<MakeHead>(make_head)(block, std::span<E>(tail, n));
+  } catch (...) {
+    std::destroy_n(tail, n);
+    deallocate_block(block, size, Layout::alignment);
+    throw;
+  }
+}
+
+template <typename T, typename E>
+struct tail_shared_state final : basic_shared_state {
+  using layout = tail_layout<tail_shared_state, E>;
+
+  template <typename... Args>
+  tail_shared_state(std::span<E> tail, Args&&... args)
+      : tail_size(tail.size()), obj(tail, std::forward<Args>(args)...) {
+    ptr = &obj;
+  }
+
+  tail_shared_state(const tail_shared_state&) = delete;
+  tail_shared_state(tail_shared_state&&) = delete;
+  tail_shared_state& operator=(const tail_shared_state&) = delete;
+  tail_shared_state& operator=(tail_shared_state&&) = delete;
+  ~tail_shared_state() = default;
+
+  // The object goes first, as it may still use its tail while being
+  // destroyed.
+  void dispose() noexcept override {
+    std::size_t n = tail_size;
+    void* block = this;
+
+    std::destroy_at(this);
+    std::destroy_n(layout::tail_of(block), n);
+    deallocate_block(block, layout::size(n), layout::alignment);
+  }
+
+  std::size_t tail_size;
+  T obj;
+};
+
+// Intrusive objects are preceded by their tail size and their
+// disposal_header.
+struct tail_prefix {
+  std::size_t tail_size;
+};
+
+template <typename T, typename E>
+struct intrusive_with_tail {
+  using object_layout = disposable_layout<tail_prefix, T>;
+
+  struct head {
+    alignas(object_layout::alignment) std::byte bytes[object_layout::size];
+  };
+  using layout = tail_layout<head, E>;
+
+  static void dispose(void* obj) noexcept {
+    std::byte* block = object_layout::block_of(obj);
+    std::size_t n =
+        std::launder(reinterpret_cast<tail_prefix*>(block))->tail_size;
+
+    std::destroy_at(static_cast<T*>(obj));
+    std::destroy_n(layout::tail_of(block), n);
+    deallocate_block(block, layout::size(n), layout::alignment);
+  }
+};
+}  // namespace details_
+
+// Element type of the trailing storage of T: T::tail_element_type if it
+// exists, std::byte otherwise.
+template <typename T>
+using tail_element_t = typename details_::tail_element<T>::type;
+
+// Creates a reference-counted T followed by n default-initialized elements of
+// tail_element_t<T>, in a single allocation along with its control block.
+//
+// T is constructed as T(std::span<tail_element_t<T>>(tail, n), args...). The
+// tail outlives the object: it is only destroyed after T's destructor ran.
+template <typename T, typename... Args>
+ref_count_ptr<T> make_ref_counted_with_tail(std::size_t n, Args&&... args) {
+  static_assert(!std::derived_from<T, region_allocated>,
+                "region_allocated types are created by ref_region::make()");
+  static_assert(!details_::foreign_ref_counted<T>,
+                "types with their own add_ref()/release() manage their own "
+                "storage");
+
+  using E = tail_element_t<T>;
+
+  if constexpr (std::derived_from<T, ref_counted>) {
+    using impl = details_::intrusive_with_tail<T, E>;
+    using object_layout = typename impl::object_layout;
+
+    T* obj = details_::construct_with_tail<typename impl::layout, E>(
+        n, [&](void* block, std::span<E> tail) {
+          std::byte* bytes = static_cast<std::byte*>(block);
+          T* result = ::new (static_cast<void*>(bytes +
+                                                object_layout::object_offset))
+              T(tail, std::forward<Args>(args)...);
+
+          ::new (static_cast<void*>(bytes)) details_::tail_prefix{n};
+          ::new (static_cast<void*>(bytes + object_layout::header_offset))
+              details_::disposal_header{&impl::dispose};
+          return result;
+        });
+
+    return details_::ref_count_ptr_access::adopt<T>(
+        details_::ref_counted_access::adopt_with_custom_disposal(obj));
+  } else {
+    using state_type = details_::tail_shared_state<T, E>;
+
+    gsl::owner<details_::basic_shared_state*> state =
+        details_::construct_with_tail<typename state_type::layout, E>(
+            n, [&](void* block, std::span<E> tail) {
+              return ::new (block)
+                  state_type(tail, std::forward<Args>(args)...);
+            });
+    state->ref_count = 1;
+    return details_::ref_count_ptr_access::adopt<T>(state);
+  }
+}
+
+}  // namespace abu::mem
+
+#endif
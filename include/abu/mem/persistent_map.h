@@ -0,0 +1,426 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_PERSISTENT_MAP_H_INCLUDED
+#define ABU_MEM_PERSISTENT_MAP_H_INCLUDED
+
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <utility>
+#include <variant>
+
+#include "abu/mem/check.h"
+#include "abu/mem/make_ref_counted_with_tail.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+namespace details_ {
+
+// Hash array mapped trie node. Each node consumes 5 bits of the hash, and only
+// stores the slots whose bit is set in its bitmap, in bit order. Nodes past
+// the last bits of the hash hold colliding entries, and no bitmap.
+template <typename K, typename V>
+class hamt_node : public ref_counted {
+ public:
+  using entry_type = std::pair<K, V>;
+  using slot_type = std::variant<entry_type, ref_count_ptr<hamt_node>>;
+  using tail_element_type = tail_slot<slot_type>;
+
+  explicit hamt_node(std::span<tail_element_type> tail, std::uint32_t bitmap)
+      : bitmap_(bitmap),
+        capacity_(static_cast<std::uint32_t>(tail.size())),
+        slots_(tail.data()) {}
+
+  hamt_node(const hamt_node&) = delete;
+  hamt_node(hamt_node&&) = delete;
+  hamt_node& operator=(const hamt_node&) = delete;
+  hamt_node& operator=(hamt_node&&) = delete;
+
+  ~hamt_node() {
+    for (std::uint32_t i = 0; i < size_; ++i) {
+      std::destroy_at(&slots_[i].value);
+    }
+  }
+
+  static ref_count_ptr<hamt_node> make(std::uint32_t capacity,
+                                       std::uint32_t bitmap = 0) {
+    return make_ref_counted_with_tail<hamt_node>(capacity, bitmap);
+  }
+
+  std::uint32_t bitmap() const noexcept {
+    return bitmap_;
+  }
+
+  std::uint32_t size() const noexcept {
+    return size_;
+  }
+
+  std::uint32_t capacity() const noexcept {
+    return capacity_;
+  }
+
+  slot_type& operator[](std::uint32_t i) noexcept {
+    assume(i < size_);
+    return slots_[i].value;
+  }
+
+  const slot_type& operator[](std::uint32_t i) const noexcept {
+    assume(i < size_);
+    return slots_[i].value;
+  }
+
+  template <typename Slot>
+  void push_back(Slot&& slot) {
+    assume(size_ < capacity_);
+    std::construct_at(&slots_[size_].value, std::forward<Slot>(slot));
+    size_ += 1;
+  }
+
+  void insert(std::uint32_t i, std::uint32_t bit, slot_type slot) {
+    assume(i <= size_ && (bitmap_ & bit) == 0);
+    if (i == size_) {
+      push_back(std::move(slot));
+    } else {
+      push_back(std::move(slots_[size_ - 1].value));
+      for (std::uint32_t j = size_ - 2; j > i; --j) {
+        slots_[j].value = std::move(slots_[j - 1].value);
+      }
+      slots_[i].value = std::move(slot);
+    }
+    bitmap_ |= bit;
+  }
+
+  void erase(std::uint32_t i, std::uint32_t bit) noexcept {
+    assume(i < size_);
+    for (std::uint32_t j = i + 1; j < size_; ++j) {
+      slots_[j - 1].value = std::move(slots_[j].value);
+    }
+    size_ -= 1;
+    std::destroy_at(&slots_[size_].value);
+    bitmap_ &= ~bit;
+  }
+
+ private:
+  std::uint32_t bitmap_;
+  std::uint32_t size_ = 0;
+  std::uint32_t capacity_;
+  tail_element_type* slots_;
+};
+}  // namespace details_
+
+// Persistent hash map with value semantics.
+//
+// Copies are O(1) and share their whole structure. Updating a copy only
+// copies the O(log n) nodes on the path to the change. Nodes that are not
+// shared with any other version are updated in place.
+template <typename K,
+          typename V,
+          typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class persistent_map {
+  using node_type = details_::hamt_node<K, V>;
+  using slot_type = typename node_type::slot_type;
+  using node_ptr = ref_count_ptr<node_type>;
+
+  static constexpr unsigned bits_per_level = 5;
+  static constexpr unsigned hash_bits = sizeof(std::size_t) * CHAR_BIT;
+
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using size_type = std::size_t;
+
+  persistent_map() = default;
+
+  explicit persistent_map(Hash hash, KeyEqual key_eq = {})
+      : hash_(std::move(hash)), key_eq_(std::move(key_eq)) {}
+
+  size_type size() const noexcept {
+    return size_;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  // The value associated with key, or nullptr.
+  const V* find(const K& key) const {
+    std::size_t hash = hash_(key);
+    const node_type* node = root_.get();
+
+    for (unsigned shift = 0; node; shift += bits_per_level) {
+      if (shift >= hash_bits) {
+        return find_collision_(*node, key);
+      }
+
+      std::uint32_t bit = bit_of_(hash, shift);
+      if ((node->bitmap() & bit) == 0) {
+        return nullptr;
+      }
+
+      const slot_type& slot = (*node)[index_of_(*node, bit)];
+      if (auto child = std::get_if<node_ptr>(&slot)) {
+        node = child->get();
+      } else {
+        const auto& entry = std::get<value_type>(slot);
+        return key_eq_(entry.first, key) ? &entry.second : nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  bool contains(const K& key) const {
+    return find(key) != nullptr;
+  }
+
+  // Returns true if key was not in the map yet.
+  bool insert_or_assign(K key, V value) {
+    if (!root_) {
+      root_ = node_type::make(1);
+    }
+
+    std::size_t hash = hash_(key);
+    bool inserted =
+        insert_(root_, true, hash, 0, std::move(key), std::move(value));
+    if (inserted) {
+      size_ += 1;
+    }
+    return inserted;
+  }
+
+  // Returns true if key was in the map.
+  bool erase(const K& key) {
+    if (!contains(key)) {
+      return false;
+    }
+
+    erase_(root_, true, hash_(key), 0, key);
+    size_ -= 1;
+    if (size_ == 0) {
+      root_.reset();
+    }
+    return true;
+  }
+
+  // Calls fn(key, value) on every entry, in no particular order.
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    if (root_) {
+      for_each_(*root_, fn);
+    }
+  }
+
+ private:
+  static std::uint32_t bit_of_(std::size_t hash, unsigned shift) noexcept {
+    return std::uint32_t{1} << ((hash >> shift) & 0x1f);
+  }
+
+  static std::uint32_t index_of_(const node_type& node,
+                                 std::uint32_t bit) noexcept {
+    return static_cast<std::uint32_t>(std::popcount(node.bitmap() & (bit - 1)));
+  }
+
+  const V* find_collision_(const node_type& node, const K& key) const {
+    for (std::uint32_t i = 0; i < node.size(); ++i) {
+      const auto& entry = std::get<value_type>(node[i]);
+      if (key_eq_(entry.first, key)) {
+        return &entry.second;
+      }
+    }
+    return nullptr;
+  }
+
+  // Makes the node held by ptr safe to modify, with room for at least
+  // min_capacity slots. unique tells if ptr is only reachable through
+  // unshared nodes.
+  static node_type& editable_(node_ptr& ptr,
+                              bool unique,
+                              std::uint32_t min_capacity) {
+    node_type& node = *ptr;
+    if (unique && node.capacity() >= min_capacity) {
+      return node;
+    }
+
+    // Growing nodes leave room for more. Copies of shared nodes are tight.
+    std::uint32_t capacity =
+        unique ? std::bit_ceil(min_capacity) : min_capacity;
+    node_ptr copy = node_type::make(capacity, node.bitmap());
+    for (std::uint32_t i = 0; i < node.size(); ++i) {
+      if (unique) {
+        copy->push_back(std::move(node[i]));
+      } else {
+        copy->push_back(std::as_const(node)[i]);
+      }
+    }
+
+    ptr = std::move(copy);
+    return *ptr;
+  }
+
+  bool insert_(node_ptr& ptr,
+               bool unique,
+               std::size_t hash,
+               unsigned shift,
+               K&& key,
+               V&& value) {
+    unique = unique && ptr.use_count() == 1;
+
+    if (shift >= hash_bits) {
+      node_type& node = editable_(ptr, unique, ptr->size());
+      for (std::uint32_t i = 0; i < node.size(); ++i) {
+        auto& entry = std::get<value_type>(node[i]);
+        if (key_eq_(entry.first, key)) {
+          entry.second = std::move(value);
+          return false;
+        }
+      }
+      editable_(ptr, true, node.size() + 1)
+          .push_back(value_type(std::move(key), std::move(value)));
+      return true;
+    }
+
+    std::uint32_t bit = bit_of_(hash, shift);
+    std::uint32_t index = index_of_(*ptr, bit);
+
+    if ((ptr->bitmap() & bit) == 0) {
+      editable_(ptr, unique, ptr->size() + 1)
+          .insert(index, bit, value_type(std::move(key), std::move(value)));
+      return true;
+    }
+
+    node_type& node = editable_(ptr, unique, ptr->size());
+    slot_type& slot = node[index];
+
+    if (auto child = std::get_if<node_ptr>(&slot)) {
+      return insert_(*child, true, hash, shift + bits_per_level,
+                     std::move(key), std::move(value));
+    }
+
+    auto& entry = std::get<value_type>(slot);
+    if (key_eq_(entry.first, key)) {
+      entry.second = std::move(value);
+      return false;
+    }
+
+    std::size_t entry_hash = hash_(entry.first);
+    node_ptr child = make_pair_(shift + bits_per_level, std::move(entry),
+                                entry_hash,
+                                value_type(std::move(key), std::move(value)),
+                                hash);
+    slot = std::move(child);
+    return true;
+  }
+
+  // Node holding two entries whose hashes match up to shift.
+  static node_ptr make_pair_(unsigned shift,
+                             value_type&& a,
+                             std::size_t hash_a,
+                             value_type&& b,
+                             std::size_t hash_b) {
+    if (shift >= hash_bits) {
+      node_ptr result = node_type::make(2);
+      result->push_back(std::move(a));
+      result->push_back(std::move(b));
+      return result;
+    }
+
+    std::uint32_t bit_a = bit_of_(hash_a, shift);
+    std::uint32_t bit_b = bit_of_(hash_b, shift);
+
+    if (bit_a == bit_b) {
+      node_ptr result = node_type::make(1, bit_a);
+      result->push_back(make_pair_(shift + bits_per_level, std::move(a),
+                                   hash_a, std::move(b), hash_b));
+      return result;
+    }
+
+    node_ptr result = node_type::make(2, bit_a | bit_b);
+    if (bit_a < bit_b) {
+      result->push_back(std::move(a));
+      result->push_back(std::move(b));
+    } else {
+      result->push_back(std::move(b));
+      result->push_back(std::move(a));
+    }
+    return result;
+  }
+
+  // key must be in the map.
+  void erase_(node_ptr& ptr,
+              bool unique,
+              std::size_t hash,
+              unsigned shift,
+              const K& key) {
+    unique = unique && ptr.use_count() == 1;
+    node_type& node = editable_(ptr, unique, ptr->size());
+
+    if (shift >= hash_bits) {
+      for (std::uint32_t i = 0; i < node.size(); ++i) {
+        if (key_eq_(std::get<value_type>(node[i]).first, key)) {
+          node.erase(i, 0);
+          return;
+        }
+      }
+      assume(false);
+    }
+
+    std::uint32_t bit = bit_of_(hash, shift);
+    std::uint32_t index = index_of_(node, bit);
+    slot_type& slot = node[index];
+
+    auto child = std::get_if<node_ptr>(&slot);
+    if (!child) {
+      node.erase(index, bit);
+      return;
+    }
+
+    erase_(*child, true, hash, shift + bits_per_level, key);
+
+    // A child left with a single entry is folded back into this node.
+    node_type& child_node = **child;
+    if (child_node.size() == 1 &&
+        std::holds_alternative<value_type>(child_node[0])) {
+      value_type entry = std::move(std::get<value_type>(child_node[0]));
+      slot = std::move(entry);
+    }
+  }
+
+  template <typename Fn>
+  static void for_each_(const node_type& node, Fn& fn) {
+    for (std::uint32_t i = 0; i < node.size(); ++i) {
+      if (auto child = std::get_if<node_ptr>(&node[i])) {
+        for_each_(**child, fn);
+      } else {
+        const auto& entry = std::get<value_type>(node[i]);
+        fn(entry.first, entry.second);
+      }
+    }
+  }
+
+  node_ptr root_;
+  size_type size_ = 0;
+  [[no_unique_address]] Hash hash_;
+  [[no_unique_address]] KeyEqual key_eq_;
+};
+
+}  // namespace abu::mem
+
+#endif
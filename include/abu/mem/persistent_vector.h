@@ -0,0 +1,422 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_PERSISTENT_VECTOR_H_INCLUDED
+#define ABU_MEM_PERSISTENT_VECTOR_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include "abu/mem/check.h"
+#include "abu/mem/make_ref_counted_with_tail.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+namespace details_ {
+
+inline constexpr unsigned vector_bits_per_level = 5;
+inline constexpr std::size_t vector_node_width = std::size_t{1}
+                                                 << vector_bits_per_level;
+
+// Node of a radix balanced tree. Leaves hold values, branches hold children.
+// Both are only ever created with make_ref_counted_with_tail(), which lets
+// them be released through a reference to this base.
+template <typename T>
+class vector_node : public ref_counted {
+ public:
+  vector_node(const vector_node&) = delete;
+  vector_node(vector_node&&) = delete;
+  vector_node& operator=(const vector_node&) = delete;
+  vector_node& operator=(vector_node&&) = delete;
+
+  // Not virtual on purpose: destruction goes through the disposal of the
+  // allocation, which knows the actual node type.
+  ~vector_node() = default;
+
+  std::uint32_t size() const noexcept {
+    return size_;
+  }
+
+ protected:
+  vector_node() = default;
+
+  std::uint32_t size_ = 0;
+};
+
+template <typename T>
+class vector_leaf final : public vector_node<T> {
+ public:
+  using tail_element_type = tail_slot<T>;
+
+  explicit vector_leaf(std::span<tail_element_type> tail)
+      : slots_(tail.data()) {}
+
+  vector_leaf(const vector_leaf&) = delete;
+  vector_leaf(vector_leaf&&) = delete;
+  vector_leaf& operator=(const vector_leaf&) = delete;
+  vector_leaf& operator=(vector_leaf&&) = delete;
+
+  ~vector_leaf() {
+    while (this->size_ != 0) {
+      pop_back();
+    }
+  }
+
+  static ref_count_ptr<vector_leaf> make() {
+    return make_ref_counted_with_tail<vector_leaf>(vector_node_width);
+  }
+
+  // A copy of this leaf.
+  ref_count_ptr<vector_leaf> clone() const {
+    auto result = make();
+    for (std::uint32_t i = 0; i < this->size_; ++i) {
+      result->push_value(slots_[i].value);
+    }
+    return result;
+  }
+
+  T& value(std::size_t i) noexcept {
+    assume(i < this->size_);
+    return slots_[i].value;
+  }
+
+  const T& value(std::size_t i) const noexcept {
+    assume(i < this->size_);
+    return slots_[i].value;
+  }
+
+  template <typename U>
+  void push_value(U&& v) {
+    assume(this->size_ < vector_node_width);
+    std::construct_at(&slots_[this->size_].value, std::forward<U>(v));
+    this->size_ += 1;
+  }
+
+  void pop_back() noexcept {
+    assume(this->size_ > 0);
+    this->size_ -= 1;
+    std::destroy_at(&slots_[this->size_].value);
+  }
+
+ private:
+  tail_element_type* slots_;
+};
+
+template <typename T>
+class vector_branch final : public vector_node<T> {
+ public:
+  using child_ptr = ref_count_ptr<vector_node<T>>;
+  using tail_element_type = tail_slot<child_ptr>;
+
+  explicit vector_branch(std::span<tail_element_type> tail)
+      : slots_(tail.data()) {}
+
+  vector_branch(const vector_branch&) = delete;
+  vector_branch(vector_branch&&) = delete;
+  vector_branch& operator=(const vector_branch&) = delete;
+  vector_branch& operator=(vector_branch&&) = delete;
+
+  ~vector_branch() {
+    while (this->size_ != 0) {
+      pop_back();
+    }
+  }
+
+  static ref_count_ptr<vector_branch> make() {
+    return make_ref_counted_with_tail<vector_branch>(vector_node_width);
+  }
+
+  // A copy of this branch, sharing its children.
+  ref_count_ptr<vector_branch> clone() const {
+    auto result = make();
+    for (std::uint32_t i = 0; i < this->size_; ++i) {
+      result->push_child(slots_[i].value);
+    }
+    return result;
+  }
+
+  child_ptr& child(std::size_t i) noexcept {
+    assume(i < this->size_);
+    return slots_[i].value;
+  }
+
+  const child_ptr& child(std::size_t i) const noexcept {
+    assume(i < this->size_);
+    return slots_[i].value;
+  }
+
+  void push_child(child_ptr c) noexcept {
+    assume(this->size_ < vector_node_width);
+    std::construct_at(&slots_[this->size_].value, std::move(c));
+    this->size_ += 1;
+  }
+
+  void pop_back() noexcept {
+    assume(this->size_ > 0);
+    this->size_ -= 1;
+    std::destroy_at(&slots_[this->size_].value);
+  }
+
+ private:
+  tail_element_type* slots_;
+};
+}  // namespace details_
+
+// Persistent vector with value semantics.
+//
+// Elements are stored in a 32-way radix balanced tree, plus a tail leaf that
+// makes push_back() and pop_back() cheap. Copies are O(1) and share their
+// whole structure. Updating a copy only copies the O(log n) nodes on the path
+// to the change. Nodes that are not shared with any other version are updated
+// in place.
+template <typename T>
+class persistent_vector {
+  using node_type = details_::vector_node<T>;
+  using leaf_type = details_::vector_leaf<T>;
+  using branch_type = details_::vector_branch<T>;
+  using node_ptr = ref_count_ptr<node_type>;
+  using leaf_ptr = ref_count_ptr<leaf_type>;
+
+  static constexpr unsigned bits = details_::vector_bits_per_level;
+  static constexpr std::size_t width = details_::vector_node_width;
+  static constexpr std::size_t mask = width - 1;
+
+ public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  persistent_vector() = default;
+
+  size_type size() const noexcept {
+    return size_;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  const T& operator[](size_type i) const noexcept {
+    precondition(i < size_, "out of bounds access");
+    return leaf_for_(i).value(i & mask);
+  }
+
+  const T& back() const noexcept {
+    precondition(size_ > 0, "back() of empty vector");
+    return (*this)[size_ - 1];
+  }
+
+  void set(size_type i, T v) {
+    precondition(i < size_, "out of bounds access");
+
+    if (i >= tail_offset_()) {
+      editable_(tail_, true).value(i & mask) = std::move(v);
+      return;
+    }
+
+    node_ptr* ptr = &root_;
+    bool unique = true;
+    for (unsigned level = shift_; level > 0; level -= bits) {
+      branch_type& node = editable_<branch_type>(*ptr, unique);
+      ptr = &node.child((i >> level) & mask);
+    }
+    editable_<leaf_type>(*ptr, unique).value(i & mask) = std::move(v);
+  }
+
+  void push_back(T v) {
+    if (!tail_) {
+      tail_ = leaf_type::make();
+    }
+
+    if (tail_->size() == width) {
+      push_tail_();
+      tail_ = leaf_type::make();
+    }
+
+    editable_(tail_, true).push_value(std::move(v));
+    size_ += 1;
+  }
+
+  void pop_back() {
+    precondition(size_ > 0, "pop_back() of empty vector");
+
+    if (size_ == 1) {
+      clear();
+      return;
+    }
+
+    if (tail_->size() > 1) {
+      editable_(tail_, true).pop_back();
+      size_ -= 1;
+      return;
+    }
+
+    // The last leaf of the tree becomes the new tail.
+    size_ -= 1;
+    tail_ = pop_tail_();
+  }
+
+  void clear() noexcept {
+    root_.reset();
+    tail_.reset();
+    size_ = 0;
+    shift_ = bits;
+  }
+
+  // Calls fn(value) on every element, in order.
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    if (root_) {
+      for_each_(*root_, shift_, fn);
+    }
+    if (tail_) {
+      for_each_(*tail_, 0, fn);
+    }
+  }
+
+ private:
+  // Makes the Node held by ptr safe to modify. unique tells if ptr is only
+  // reachable through unshared nodes, and is updated for the node's children.
+  template <typename Node, typename Ptr>
+  static Node& editable_(Ptr& ptr, bool& unique) {
+    unique = unique && ptr.use_count() == 1;
+    if (!unique) {
+      ptr = static_cast<const Node&>(*ptr).clone();
+      unique = true;
+    }
+    return static_cast<Node&>(*ptr);
+  }
+
+  static leaf_type& editable_(leaf_ptr& ptr, bool&& unique) {
+    return editable_<leaf_type>(ptr, unique);
+  }
+
+  // Index of the first element held by the tail.
+  size_type tail_offset_() const noexcept {
+    return size_ - (tail_ ? tail_->size() : 0);
+  }
+
+  const leaf_type& leaf_for_(size_type i) const noexcept {
+    if (i >= tail_offset_()) {
+      return *tail_;
+    }
+
+    const node_type* node = root_.get();
+    for (unsigned level = shift_; level > 0; level -= bits) {
+      node = static_cast<const branch_type*>(node)
+                 ->child((i >> level) & mask)
+                 .get();
+    }
+    return static_cast<const leaf_type&>(*node);
+  }
+
+  // Moves the full tail into the tree.
+  void push_tail_() {
+    size_type index = tail_offset_();
+
+    if (!root_) {
+      root_ = std::move(tail_);
+      shift_ = 0;
+      return;
+    }
+
+    // The tree is full, or is a single leaf: it becomes the first child of a
+    // new root.
+    if ((index >> shift_) >= width) {
+      auto new_root = branch_type::make();
+      new_root->push_child(std::move(root_));
+      root_ = std::move(new_root);
+      shift_ += bits;
+    }
+
+    node_ptr* ptr = &root_;
+    bool unique = true;
+    for (unsigned level = shift_; level > bits; level -= bits) {
+      branch_type& node = editable_<branch_type>(*ptr, unique);
+      std::size_t sub = (index >> level) & mask;
+      if (sub == node.size()) {
+        node.push_child(branch_type::make());
+      }
+      ptr = &node.child(sub);
+    }
+    editable_<branch_type>(*ptr, unique).push_child(std::move(tail_));
+  }
+
+  // Removes the last leaf of the tree, and returns it.
+  leaf_ptr pop_tail_() {
+    if (shift_ == 0) {
+      shift_ = bits;
+      return static_ref_cast<leaf_type>(std::exchange(root_, nullptr));
+    }
+
+    node_ptr result;
+    pop_leaf_(root_, true, shift_, result);
+
+    // Drop levels that are no longer needed.
+    while (shift_ > 0 && root_->size() == 1) {
+      node_ptr only = static_cast<const branch_type&>(*root_).child(0);
+      root_ = std::move(only);
+      shift_ -= bits;
+    }
+    return static_ref_cast<leaf_type>(std::move(result));
+  }
+
+  static void pop_leaf_(node_ptr& ptr,
+                        bool unique,
+                        unsigned level,
+                        node_ptr& result) {
+    branch_type& node = editable_<branch_type>(ptr, unique);
+    if (level == bits) {
+      result = std::move(node.child(node.size() - 1));
+      node.pop_back();
+      return;
+    }
+
+    node_ptr& last = node.child(node.size() - 1);
+    pop_leaf_(last, unique, level - bits, result);
+    if (last->size() == 0) {
+      node.pop_back();
+    }
+  }
+
+  template <typename Fn>
+  static void for_each_(const node_type& node, unsigned level, Fn& fn) {
+    if (level == 0) {
+      const auto& leaf = static_cast<const leaf_type&>(node);
+      for (std::uint32_t i = 0; i < leaf.size(); ++i) {
+        fn(leaf.value(i));
+      }
+      return;
+    }
+
+    const auto& branch = static_cast<const branch_type&>(node);
+    for (std::uint32_t i = 0; i < branch.size(); ++i) {
+      for_each_(*branch.child(i), level - bits, fn);
+    }
+  }
+
+  node_ptr root_;
+  leaf_ptr tail_;
+  size_type size_ = 0;
+
+  // Bits consumed above the leaves. 0 when the root is a leaf.
+  unsigned shift_ = bits;
+};
+
+}  // namespace abu::mem
+
+#endif
@@ -1,393 +1,836 @@
-// Copyright 2021 Francois Chabot
-
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-
-//     http://www.apache.org/licenses/LICENSE-2.0
-
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-#ifndef ABU_MEM_REF_COUNT_H_INCLUDED
-#define ABU_MEM_REF_COUNT_H_INCLUDED
-
-#include <concepts>
-#include <utility>
-
-#include "abu/mem/check.h"
-
-namespace gsl {
-template <typename T>
-concept Pointer = std::is_pointer_v<T>;
-
-template <Pointer T>
-using owner = T;
-
-}  // namespace gsl
-
-namespace abu::mem {
-
-namespace details_ {
-struct basic_shared_state {
-  basic_shared_state() = default;
-  basic_shared_state(const basic_shared_state&) = delete;
-  basic_shared_state(basic_shared_state&&) = delete;
-  basic_shared_state& operator=(const basic_shared_state&) = delete;
-  basic_shared_state& operator=(basic_shared_state&&) = delete;
-
-  virtual ~basic_shared_state() {}
-
-  long ref_count = 0;
-  void* ptr = nullptr;
-};
-
-template <typename T>
-struct owned_shared_state : basic_shared_state {
-  template <typename... Args>
-  owned_shared_state(Args&&... args) : obj(std::forward<Args>(args)...) {
-    ptr = &obj;
-  }
-
-  owned_shared_state(const owned_shared_state&) = delete;
-  owned_shared_state(owned_shared_state&&) = delete;
-  owned_shared_state& operator=(const owned_shared_state&) = delete;
-  owned_shared_state& operator=(owned_shared_state&&) = delete;
-  ~owned_shared_state() = default;
-
-  T obj;
-};
-
-template <typename T>
-struct referenced_shared_state : basic_shared_state {
-  referenced_shared_state(T* init) {
-    ptr = init;
-  }
-  referenced_shared_state(const referenced_shared_state&) = delete;
-  referenced_shared_state(referenced_shared_state&&) = delete;
-  referenced_shared_state& operator=(const referenced_shared_state&) = delete;
-  referenced_shared_state& operator=(referenced_shared_state&&) = delete;
-
-  ~referenced_shared_state() {
-    delete static_cast<T*>(ptr);
-  }
-};
-}  // namespace details_
-
-template <typename T>
-struct ref_count_traits {
-  static gsl::owner<void*> create_shared_state(T* ptr) noexcept {
-    assume(ptr);
-    gsl::owner<details_::referenced_shared_state<T>*> shared_state =
-        new details_::referenced_shared_state<T>(ptr);
-    shared_state->ref_count = 1;
-    return shared_state;
-  }
-
-  static void add_ref(void* shared_state) noexcept {
-    assume(shared_state);
-    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
-
-    bss->ref_count += 1;
-  }
-
-  static void remove_ref(void* shared_state) noexcept {
-    assume(shared_state);
-    gsl::owner<details_::basic_shared_state*> bss =
-        static_cast<gsl::owner<details_::basic_shared_state*>>(shared_state);
-
-    assume(bss->ref_count > 0);
-    bss->ref_count -= 1;
-
-    if (bss->ref_count == 0) {
-      delete bss;
-    }
-  }
-
-  static long use_count(void* shared_state) noexcept {
-    assume(shared_state);
-    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
-
-    return bss->ref_count;
-  }
-
-  static T* resolve(void* shared_state) noexcept {
-    assume(shared_state);
-    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
-
-    return static_cast<T*>(bss->ptr);
-  }
-
-  template <typename... Args>
-  static void* make_obj_and_shared_state(Args&&... args) {
-    gsl::owner<details_::basic_shared_state*> shared_state =
-        new details_::owned_shared_state<T>(std::forward<Args>(args)...);
-    shared_state->ref_count = 1;
-    return shared_state;
-  }
-};
-
-class ref_counted {
-  template <typename T>
-  friend struct ref_count_traits;
-
-  long ref_count_ = 0;
-
- protected:
-  // Not virtual on purpose.
-  ~ref_counted() = default;
-
-  ref_counted() = default;
-  ref_counted(const ref_counted&) = default;
-  ref_counted(ref_counted&&) = default;
-  ref_counted& operator=(const ref_counted&) = default;
-  ref_counted& operator=(ref_counted&&) = default;
-};
-
-template <std::derived_from<ref_counted> T>
-struct ref_count_traits<T> {
-  static ref_counted* create_shared_state(T* ptr) noexcept {
-    assume(ptr);
-    ptr->ref_count_ += 1;
-    return ptr;
-  }
-
-  static void add_ref(void* shared_state) noexcept {
-    assume(shared_state);
-    ref_counted* rc = static_cast<ref_counted*>(shared_state);
-
-    rc->ref_count_ += 1;
-  }
-
-  static void remove_ref(void* shared_state) noexcept {
-    assume(shared_state);
-    ref_counted* rc = static_cast<ref_counted*>(shared_state);
-
-    assume(rc->ref_count_ > 0);
-
-    rc->ref_count_ -= 1;
-    if (rc->ref_count_ == 0) {
-      gsl::owner<T*> obj = static_cast<gsl::owner<T*>>(rc);
-      delete obj;
-    }
-  }
-
-  static long use_count(void* shared_state) noexcept {
-    assume(shared_state);
-    ref_counted* rc = static_cast<ref_counted*>(shared_state);
-
-    return rc->ref_count_;
-  }
-
-  static T* resolve(void* shared_state) noexcept {
-    ref_counted* rc = static_cast<ref_counted*>(shared_state);
-    return static_cast<T*>(rc);
-  }
-
-  template <typename... Args>
-  static void* make_obj_and_shared_state(Args&&... args) {
-    gsl::owner<ref_counted*> result = new T(std::forward<Args>(args)...);
-    result->ref_count_ = 1;
-    return result;
-  }
-};
-
-template <typename T>
-class ref_count_ptr {
- public:
-  using element_type = T;
-
-  // ********** Constructors **********
-  ref_count_ptr() noexcept = default;
-  ref_count_ptr(std::nullptr_t) noexcept {}
-
-  explicit ref_count_ptr(T* ptr) noexcept {
-    if (ptr) {
-      shared_state_ = ref_count_traits<T>::create_shared_state(ptr);
-    }
-  }
-
-  template <std::derived_from<T> Y>
-  explicit ref_count_ptr(Y* ptr) noexcept {
-    if (ptr) {
-      shared_state_ = ref_count_traits<T>::create_shared_state(ptr);
-    }
-  }
-
-  ref_count_ptr(const ref_count_ptr& other) noexcept
-      : shared_state_(other.shared_state_) {
-    add_ref_();
-  }
-
-  template <std::derived_from<T> Y>
-  ref_count_ptr(const ref_count_ptr<Y>& other) noexcept
-      : shared_state_(other.shared_state_) {
-    add_ref_();
-  }
-
-  ref_count_ptr(ref_count_ptr&& other) noexcept
-      : shared_state_(other.shared_state_) {
-    other.clear_();
-  }
-
-  template <std::derived_from<T> Y>
-  ref_count_ptr(ref_count_ptr<Y>&& other) noexcept
-      : shared_state_(other.shared_state_) {
-    other.clear_();
-  }
-
-  // ********** Destructor **********
-  ~ref_count_ptr() {
-    release_();
-  }
-
-  // ********** operator=() **********
-  ref_count_ptr& operator=(const ref_count_ptr& rhs) noexcept {
-    release_();
-    shared_state_ = rhs.shared_state_;
-    add_ref_();
-    return *this;
-  }
-
-  template <std::derived_from<T> Y>
-  ref_count_ptr& operator=(const ref_count_ptr<Y>& rhs) noexcept {
-    release_();
-    shared_state_ = rhs.shared_state_;
-    add_ref_();
-    return *this;
-  }
-
-  ref_count_ptr& operator=(ref_count_ptr&& rhs) noexcept {
-    release_();
-    shared_state_ = rhs.shared_state_;
-    rhs.clear_();
-    return *this;
-  }
-
-  template <std::derived_from<T> Y>
-  ref_count_ptr& operator=(ref_count_ptr<Y>&& rhs) noexcept {
-    release_();
-    shared_state_ = rhs.shared_state_;
-    rhs.clear_();
-    return *this;
-  }
-
-  // ********** reset() **********
-  void reset() noexcept {
-    release_();
-    clear_();
-  }
-
-  // ********** get() **********
-  element_type* get() const noexcept {
-    if (shared_state_) {
-      return ref_count_traits<T>::resolve(handle_());
-    }
-    return nullptr;
-  }
-
-  // ********** operator*() **********
-  T& operator*() const noexcept {
-    precondition(shared_state_, "accessing null pointer");
-
-    return *ref_count_traits<T>::resolve(handle_());
-  }
-
-  // ********** operator->() **********
-  T* operator->() const noexcept {
-    precondition(shared_state_, "accessing null pointer");
-
-    return ref_count_traits<T>::resolve(handle_());
-  }
-
-  // ********** use_count() **********
-  long use_count() const noexcept {
-    if (!shared_state_) {
-      return 0;
-    }
-    return ref_count_traits<T>::use_count(handle_());
-  }
-
-  // ********** operator bool() **********
-  explicit operator bool() const noexcept {
-    return shared_state_ != nullptr;
-  }
-
- private:
-  void* handle_() const noexcept {
-    return shared_state_;
-  }
-
-  void clear_() noexcept {
-    shared_state_ = nullptr;
-  }
-
-  void add_ref_() noexcept {
-    if (shared_state_) {
-      ref_count_traits<T>::add_ref(handle_());
-    }
-  }
-
-  void release_() noexcept {
-    if (shared_state_) {
-      ref_count_traits<T>::remove_ref(handle_());
-    }
-  }
-
-  void* shared_state_ = nullptr;
-
-  template <typename U, typename... Args>
-  friend ref_count_ptr<U> make_ref_counted(Args&&... args);
-
-  template <typename U>
-  friend void swap(ref_count_ptr<U>& lhs, ref_count_ptr<U>& rhs) noexcept;
-
-  template <typename U>
-  friend class ref_count_ptr;
-};
-
-// ********** swap() **********
-template <class T>
-void swap(ref_count_ptr<T>& lhs, ref_count_ptr<T>& rhs) noexcept {
-  std::swap(lhs.shared_state_, rhs.shared_state_);
-}
-
-template <typename T, typename... Args>
-ref_count_ptr<T> make_ref_counted(Args&&... args) {
-  ref_count_ptr<T> result;
-  result.shared_state_ = ref_count_traits<T>::make_obj_and_shared_state(
-      std::forward<Args>(args)...);
-  return result;
-}
-
-template <class T, class U>
-bool operator==(const ref_count_ptr<T>& lhs,
-                const ref_count_ptr<U>& rhs) noexcept {
-  return lhs.get() == rhs.get();
-}
-
-template <class T>
-bool operator==(const ref_count_ptr<T>& lhs, std::nullptr_t) noexcept {
-  return !lhs;
-}
-
-template <class T, class U>
-std::strong_ordering operator<=>(const ref_count_ptr<T>& lhs,
-                                 const ref_count_ptr<U>& rhs) noexcept {
-  return std::compare_three_way{}(lhs.get(), rhs.get());
-}
-
-template <class T>
-std::strong_ordering operator<=>(const ref_count_ptr<T>& lhs,
-                                 std::nullptr_t) noexcept {
-  return std::compare_three_way{}(
-      lhs.get(),
-      static_cast<typename ref_count_ptr<T>::element_type*>(nullptr));
-}
-
-}  // namespace abu::mem
-
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_REF_COUNT_H_INCLUDED
+#define ABU_MEM_REF_COUNT_H_INCLUDED
+
+#include <algorithm>
+#include <climits>
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "abu/mem/check.h"
+
+namespace gsl {
+template <typename T>
+concept Pointer = std::is_pointer_v<T>;
+
+template <Pointer T>
+using owner = T;
+
+}  // namespace gsl
+
+namespace abu::mem {
+
+template <typename T>
+class ref_count_ptr;
+
+namespace details_ {
+// Number of ref_view<> currently borrowing an object. It only holds anything
+// when borrows are tracked.
+template <bool Tracked = borrow_tracking>
+struct borrow_count {
+  void add_borrow() noexcept {}
+  void remove_borrow() noexcept {}
+  bool has_borrows() const noexcept {
+    return false;
+  }
+};
+
+template <>
+struct borrow_count<true> {
+  borrow_count() = default;
+
+  // Borrows are tied to an object's storage, not to its value.
+  borrow_count(const borrow_count&) noexcept {}
+  borrow_count& operator=(const borrow_count&) noexcept {
+    return *this;
+  }
+  ~borrow_count() = default;
+
+  void add_borrow() noexcept {
+    borrows += 1;
+  }
+
+  void remove_borrow() noexcept {
+    assume(borrows > 0);
+    borrows -= 1;
+  }
+
+  bool has_borrows() const noexcept {
+    return borrows != 0;
+  }
+
+  long borrows = 0;
+};
+
+struct ref_count_ptr_access {
+  template <typename T>
+  static void* handle(const ref_count_ptr<T>& ptr) noexcept {
+    return ptr.shared_state_;
+  }
+
+  // Builds a pointer that takes over a reference already held on
+  // shared_state.
+  template <typename T>
+  static ref_count_ptr<T> adopt(void* shared_state) noexcept {
+    ref_count_ptr<T> result;
+    result.shared_state_ = shared_state;
+    return result;
+  }
+
+  // Takes over the reference held by ptr, leaving it null.
+  template <typename T>
+  static void* take(ref_count_ptr<T>& ptr) noexcept {
+    return std::exchange(ptr.shared_state_, nullptr);
+  }
+};
+
+// Flag set in the count of a ref_counted object that was not created by new.
+// Such objects are immediately preceded by a disposal_header.
+inline constexpr long custom_disposal_flag = 1L
+                                             << (sizeof(long) * CHAR_BIT - 2);
+
+struct disposal_header {
+  // Receives the address of the complete object.
+  void (*dispose)(void* obj) noexcept;
+
+  static disposal_header* of(void* obj) noexcept {
+    return static_cast<disposal_header*>(obj) - 1;
+  }
+};
+
+constexpr std::size_t align_up(std::size_t v, std::size_t alignment) noexcept {
+  return (v + alignment - 1) / alignment * alignment;
+}
+
+// Layout of a block holding Prefix, then a disposal_header, then a T that
+// starts exactly at the end of the header.
+template <typename Prefix, typename T>
+struct disposable_layout {
+  static constexpr std::size_t alignment = std::max(
+      {alignof(Prefix), alignof(disposal_header), alignof(T)});
+
+  static constexpr std::size_t object_offset =
+      align_up(align_up(sizeof(Prefix), alignof(disposal_header)) +
+                   sizeof(disposal_header),
+               alignof(T));
+
+  static constexpr std::size_t header_offset =
+      object_offset - sizeof(disposal_header);
+
+  static constexpr std::size_t size = object_offset + sizeof(T);
+
+  static std::byte* block_of(void* obj) noexcept {
+    return static_cast<std::byte*>(obj) - object_offset;
+  }
+};
+
+template <typename T>
+void* complete_object(T* obj) noexcept {
+  if constexpr (std::is_polymorphic_v<T>) {
+    return const_cast<void*>(dynamic_cast<const volatile void*>(obj));
+  } else {
+    return const_cast<std::remove_cv_t<T>*>(obj);
+  }
+}
+
+struct basic_shared_state : borrow_count<> {
+  basic_shared_state() = default;
+  basic_shared_state(const basic_shared_state&) = delete;
+  basic_shared_state(basic_shared_state&&) = delete;
+  basic_shared_state& operator=(const basic_shared_state&) = delete;
+  basic_shared_state& operator=(basic_shared_state&&) = delete;
+
+  virtual ~basic_shared_state() {}
+
+  // Destroys the shared state and hands back its storage.
+  virtual void dispose() noexcept {
+    delete this;
+  }
+
+  long ref_count = 0;
+  void* ptr = nullptr;
+};
+
+template <typename T>
+struct owned_shared_state : basic_shared_state {
+  template <typename... Args>
+  owned_shared_state(Args&&... args) : obj(std::forward<Args>(args)...) {
+    ptr = &obj;
+  }
+
+  owned_shared_state(const owned_shared_state&) = delete;
+  owned_shared_state(owned_shared_state&&) = delete;
+  owned_shared_state& operator=(const owned_shared_state&) = delete;
+  owned_shared_state& operator=(owned_shared_state&&) = delete;
+  ~owned_shared_state() = default;
+
+  T obj;
+};
+
+template <typename T>
+struct referenced_shared_state : basic_shared_state {
+  referenced_shared_state(T* init) {
+    ptr = init;
+  }
+  referenced_shared_state(const referenced_shared_state&) = delete;
+  referenced_shared_state(referenced_shared_state&&) = delete;
+  referenced_shared_state& operator=(const referenced_shared_state&) = delete;
+  referenced_shared_state& operator=(referenced_shared_state&&) = delete;
+
+  ~referenced_shared_state() {
+    delete static_cast<T*>(ptr);
+  }
+};
+}  // namespace details_
+
+template <typename T>
+struct ref_count_traits {
+  static gsl::owner<void*> create_shared_state(T* ptr) noexcept {
+    assume(ptr);
+    gsl::owner<details_::referenced_shared_state<T>*> shared_state =
+        new details_::referenced_shared_state<T>(ptr);
+    shared_state->ref_count = 1;
+    return shared_state;
+  }
+
+  static void add_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
+
+    bss->ref_count += 1;
+  }
+
+  static void remove_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    gsl::owner<details_::basic_shared_state*> bss =
+        static_cast<gsl::owner<details_::basic_shared_state*>>(shared_state);
+
+    assume(bss->ref_count > 0);
+    bss->ref_count -= 1;
+
+    if (bss->ref_count == 0) {
+      borrow_check(!bss->has_borrows(), "ref_view outlived its referent");
+      bss->dispose();
+    }
+  }
+
+  static void add_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    static_cast<details_::basic_shared_state*>(shared_state)->add_borrow();
+  }
+
+  static void remove_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    static_cast<details_::basic_shared_state*>(shared_state)->remove_borrow();
+  }
+
+  static long use_count(void* shared_state) noexcept {
+    assume(shared_state);
+    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
+
+    return bss->ref_count;
+  }
+
+  static T* resolve(void* shared_state) noexcept {
+    assume(shared_state);
+    auto bss = static_cast<details_::basic_shared_state*>(shared_state);
+
+    return static_cast<T*>(bss->ptr);
+  }
+
+  template <typename... Args>
+  static void* make_obj_and_shared_state(Args&&... args) {
+    gsl::owner<details_::basic_shared_state*> shared_state =
+        new details_::owned_shared_state<T>(std::forward<Args>(args)...);
+    shared_state->ref_count = 1;
+    return shared_state;
+  }
+};
+
+class ref_counted;
+
+namespace details_ {
+struct ref_counted_access {
+  // Takes the first reference on an object whose storage is released by the
+  // disposal_header in front of it.
+  static void* adopt_with_custom_disposal(ref_counted* rc) noexcept;
+};
+}  // namespace details_
+
+class ref_counted : details_::borrow_count<> {
+  template <typename T>
+  friend struct ref_count_traits;
+  friend struct details_::ref_counted_access;
+
+  long ref_count_ = 0;
+
+ protected:
+  // Not virtual on purpose.
+  ~ref_counted() = default;
+
+  ref_counted() = default;
+
+  // The count belongs to the object's storage, not to its value.
+  ref_counted(const ref_counted&) noexcept : details_::borrow_count<>() {}
+  ref_counted(ref_counted&&) noexcept : details_::borrow_count<>() {}
+  ref_counted& operator=(const ref_counted&) noexcept {
+    return *this;
+  }
+  ref_counted& operator=(ref_counted&&) noexcept {
+    return *this;
+  }
+};
+
+inline void* details_::ref_counted_access::adopt_with_custom_disposal(
+    ref_counted* rc) noexcept {
+  assume(rc && rc->ref_count_ == 0);
+  rc->ref_count_ = custom_disposal_flag | 1;
+  return rc;
+}
+
+template <std::derived_from<ref_counted> T>
+struct ref_count_traits<T> {
+  static ref_counted* create_shared_state(T* ptr) noexcept {
+    assume(ptr);
+    ptr->ref_count_ += 1;
+    return ptr;
+  }
+
+  static void add_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    ref_counted* rc = static_cast<ref_counted*>(shared_state);
+
+    rc->ref_count_ += 1;
+  }
+
+// When an object is created and released within the same function, gcc cannot
+// always tell which of the two disposal paths it takes.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#pragma GCC diagnostic ignored "-Wfree-nonheap-object"
+#pragma GCC diagnostic ignored "-Wuse-after-free"
+#endif
+  static void remove_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    ref_counted* rc = static_cast<ref_counted*>(shared_state);
+
+    assume((rc->ref_count_ & ~details_::custom_disposal_flag) > 0);
+
+    rc->ref_count_ -= 1;
+    if ((rc->ref_count_ & ~details_::custom_disposal_flag) == 0) {
+      borrow_check(!rc->has_borrows(), "ref_view outlived its referent");
+      gsl::owner<T*> obj = static_cast<gsl::owner<T*>>(rc);
+      if (rc->ref_count_ == 0) {
+        delete obj;
+      } else {
+        void* complete = details_::complete_object(obj);
+        details_::disposal_header::of(complete)->dispose(complete);
+      }
+    }
+  }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+  static void add_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    static_cast<ref_counted*>(shared_state)->add_borrow();
+  }
+
+  static void remove_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    static_cast<ref_counted*>(shared_state)->remove_borrow();
+  }
+
+  static long use_count(void* shared_state) noexcept {
+    assume(shared_state);
+    ref_counted* rc = static_cast<ref_counted*>(shared_state);
+
+    return rc->ref_count_ & ~details_::custom_disposal_flag;
+  }
+
+  static T* resolve(void* shared_state) noexcept {
+    ref_counted* rc = static_cast<ref_counted*>(shared_state);
+    return static_cast<T*>(rc);
+  }
+
+  template <typename... Args>
+  static void* make_obj_and_shared_state(Args&&... args) {
+    gsl::owner<ref_counted*> result = new T(std::forward<Args>(args)...);
+    result->ref_count_ = 1;
+    return result;
+  }
+};
+
+class region_allocated;
+
+namespace details_ {
+// Hooks of types that carry their own count. Members win over free functions,
+// which are only looked up through ADL.
+namespace foreign_hooks {
+void add_ref() = delete;
+void release() = delete;
+void use_count() = delete;
+
+template <typename T>
+concept member_hooks = requires(T& obj) {
+  obj.add_ref();
+  obj.release();
+};
+
+template <typename T>
+concept adl_hooks = requires(T* obj) {
+  add_ref(obj);
+  release(obj);
+};
+
+template <typename T>
+concept member_use_count = requires(const T& obj) {
+  { obj.use_count() } -> std::convertible_to<long>;
+};
+
+template <typename T>
+concept adl_use_count = requires(const T* obj) {
+  { use_count(obj) } -> std::convertible_to<long>;
+};
+
+template <typename T>
+void call_add_ref(T* obj) noexcept {
+  if constexpr (member_hooks<T>) {
+    obj->add_ref();
+  } else {
+    add_ref(obj);
+  }
+}
+
+// Whatever the object does once its count reaches zero is up to it.
+template <typename T>
+void call_release(T* obj) noexcept {
+  if constexpr (member_hooks<T>) {
+    obj->release();
+  } else {
+    release(obj);
+  }
+}
+
+template <typename T>
+long call_use_count(const T* obj) noexcept {
+  if constexpr (member_use_count<T>) {
+    return static_cast<long>(obj->use_count());
+  } else {
+    return static_cast<long>(use_count(obj));
+  }
+}
+}  // namespace foreign_hooks
+
+template <typename T>
+concept foreign_ref_counted =
+    !std::derived_from<T, ref_counted> &&
+    !std::derived_from<T, region_allocated> &&
+    (foreign_hooks::member_hooks<std::remove_cv_t<T>> ||
+     foreign_hooks::adl_hooks<std::remove_cv_t<T>>);
+
+// Which ref_count_traits<> manages T. A handle only makes sense to traits of
+// the same family.
+enum class ref_count_family { control_block, intrusive, region, foreign };
+
+template <typename T>
+constexpr ref_count_family ref_count_family_of() noexcept {
+  using type = std::remove_cv_t<T>;
+  if constexpr (std::derived_from<type, ref_counted>) {
+    return ref_count_family::intrusive;
+  } else if constexpr (std::derived_from<type, region_allocated>) {
+    return ref_count_family::region;
+  } else if constexpr (foreign_ref_counted<type>) {
+    return ref_count_family::foreign;
+  } else {
+    return ref_count_family::control_block;
+  }
+}
+
+template <typename T, typename Y>
+concept same_ref_count_family =
+    ref_count_family_of<T>() == ref_count_family_of<Y>();
+
+// A reference to Y can be used as a reference to T: Y is a T, and both are
+// managed the same way. Same types are let through first, as they may still
+// be incomplete.
+template <typename Y, typename T>
+concept ref_convertible_to =
+    std::derived_from<Y, T> &&
+    (std::same_as<std::remove_cv_t<Y>, std::remove_cv_t<T>> ||
+     same_ref_count_family<Y, T>);
+
+// Foreign objects are their own shared state, so the handle of a
+// ref_count_ptr<T> is a T*, which needs adjusting when converted to a base.
+template <typename T, typename Y>
+void* rebind_handle(void* handle) noexcept {
+  if constexpr (foreign_ref_counted<T>) {
+    T* obj = static_cast<Y*>(handle);
+    return const_cast<std::remove_cv_t<T>*>(obj);
+  } else {
+    return handle;
+  }
+}
+}  // namespace details_
+
+// Types that expose add_ref()/release(), either as members or as free
+// functions taking a T*, are managed through these hooks directly.
+//
+// Like ref_counted, objects are expected to start with a count of zero, and
+// the first ref_count_ptr takes the first reference. use_count() is only
+// available if the type also exposes a use_count() hook. Borrows are not
+// tracked for such types.
+template <details_::foreign_ref_counted T>
+struct ref_count_traits<T> {
+  using hooked_type = std::remove_cv_t<T>;
+
+  static void* create_shared_state(T* ptr) noexcept {
+    assume(ptr);
+    void* handle = const_cast<hooked_type*>(ptr);
+    add_ref(handle);
+    return handle;
+  }
+
+  static void add_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::foreign_hooks::call_add_ref(
+        static_cast<hooked_type*>(shared_state));
+  }
+
+  static void remove_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::foreign_hooks::call_release(
+        static_cast<hooked_type*>(shared_state));
+  }
+
+  static void add_borrow(void*) noexcept {}
+
+  static void remove_borrow(void*) noexcept {}
+
+  static long use_count(void* shared_state) noexcept requires(
+      details_::foreign_hooks::member_use_count<hooked_type> ||
+      details_::foreign_hooks::adl_use_count<hooked_type>) {
+    assume(shared_state);
+    return details_::foreign_hooks::call_use_count(
+        static_cast<const hooked_type*>(shared_state));
+  }
+
+  static T* resolve(void* shared_state) noexcept {
+    return static_cast<T*>(shared_state);
+  }
+
+  template <typename... Args>
+  static void* make_obj_and_shared_state(Args&&... args) {
+    return create_shared_state(new T(std::forward<Args>(args)...));
+  }
+};
+
+template <typename T>
+class ref_count_ptr {
+ public:
+  using element_type = T;
+
+  // ********** Constructors **********
+  ref_count_ptr() noexcept = default;
+  ref_count_ptr(std::nullptr_t) noexcept {}
+
+  explicit ref_count_ptr(T* ptr) noexcept {
+    if (ptr) {
+      shared_state_ = ref_count_traits<T>::create_shared_state(ptr);
+    }
+  }
+
+  template <std::derived_from<T> Y>
+  explicit ref_count_ptr(Y* ptr) noexcept {
+    if (ptr) {
+      shared_state_ = ref_count_traits<T>::create_shared_state(ptr);
+    }
+  }
+
+  ref_count_ptr(const ref_count_ptr& other) noexcept
+      : shared_state_(other.shared_state_) {
+    add_ref_();
+  }
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_count_ptr(const ref_count_ptr<Y>& other) noexcept
+      : shared_state_(details_::rebind_handle<T, Y>(other.shared_state_)) {
+    add_ref_();
+  }
+
+  ref_count_ptr(ref_count_ptr&& other) noexcept
+      : shared_state_(other.shared_state_) {
+    other.clear_();
+  }
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_count_ptr(ref_count_ptr<Y>&& other) noexcept
+      : shared_state_(details_::rebind_handle<T, Y>(other.shared_state_)) {
+    other.clear_();
+  }
+
+  // ********** Destructor **********
+  ~ref_count_ptr() {
+    release_();
+  }
+
+  // ********** operator=() **********
+  ref_count_ptr& operator=(const ref_count_ptr& rhs) noexcept {
+    release_();
+    shared_state_ = rhs.shared_state_;
+    add_ref_();
+    return *this;
+  }
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_count_ptr& operator=(const ref_count_ptr<Y>& rhs) noexcept {
+    release_();
+    shared_state_ = details_::rebind_handle<T, Y>(rhs.shared_state_);
+    add_ref_();
+    return *this;
+  }
+
+  ref_count_ptr& operator=(ref_count_ptr&& rhs) noexcept {
+    release_();
+    shared_state_ = rhs.shared_state_;
+    rhs.clear_();
+    return *this;
+  }
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_count_ptr& operator=(ref_count_ptr<Y>&& rhs) noexcept {
+    release_();
+    shared_state_ = details_::rebind_handle<T, Y>(rhs.shared_state_);
+    rhs.clear_();
+    return *this;
+  }
+
+  // ********** reset() **********
+  void reset() noexcept {
+    release_();
+    clear_();
+  }
+
+  // ********** get() **********
+  element_type* get() const noexcept {
+    if (shared_state_) {
+      return ref_count_traits<T>::resolve(handle_());
+    }
+    return nullptr;
+  }
+
+  // ********** operator*() **********
+  T& operator*() const noexcept {
+    precondition(shared_state_, "accessing null pointer");
+
+    return *ref_count_traits<T>::resolve(handle_());
+  }
+
+  // ********** operator->() **********
+  T* operator->() const noexcept {
+    precondition(shared_state_, "accessing null pointer");
+
+    return ref_count_traits<T>::resolve(handle_());
+  }
+
+  // ********** use_count() **********
+  long use_count() const noexcept {
+    if (!shared_state_) {
+      return 0;
+    }
+    return ref_count_traits<T>::use_count(handle_());
+  }
+
+  // ********** operator bool() **********
+  explicit operator bool() const noexcept {
+    return shared_state_ != nullptr;
+  }
+
+ private:
+  void* handle_() const noexcept {
+    return shared_state_;
+  }
+
+  void clear_() noexcept {
+    shared_state_ = nullptr;
+  }
+
+  void add_ref_() noexcept {
+    if (shared_state_) {
+      ref_count_traits<T>::add_ref(handle_());
+    }
+  }
+
+  void release_() noexcept {
+    if (shared_state_) {
+      ref_count_traits<T>::remove_ref(handle_());
+    }
+  }
+
+  void* shared_state_ = nullptr;
+
+  friend struct details_::ref_count_ptr_access;
+
+  template <typename U>
+  friend void swap(ref_count_ptr<U>& lhs, ref_count_ptr<U>& rhs) noexcept;
+
+  template <typename U>
+  friend class ref_count_ptr;
+};
+
+// ********** swap() **********
+template <class T>
+void swap(ref_count_ptr<T>& lhs, ref_count_ptr<T>& rhs) noexcept {
+  std::swap(lhs.shared_state_, rhs.shared_state_);
+}
+
+template <typename T, typename... Args>
+ref_count_ptr<T> make_ref_counted(Args&&... args) {
+  return details_::ref_count_ptr_access::adopt<T>(
+      ref_count_traits<T>::make_obj_and_shared_state(
+          std::forward<Args>(args)...));
+}
+
+namespace details_ {
+// Casts reuse the source's shared state as is. This only works if the target
+// type resolves that shared state to the cast object. Returns null when there
+// is nothing to cast, or when the shared state cannot be reused.
+template <typename U, typename T>
+void* ref_cast_handle(const ref_count_ptr<T>& ptr, U* casted) noexcept {
+  static_assert(same_ref_count_family<U, T>,
+                "casting between types managed by different ref_count_traits");
+
+  if (!casted) {
+    return nullptr;
+  }
+
+  if constexpr (ref_count_family_of<U>() == ref_count_family::foreign) {
+    // Foreign objects are their own handle.
+    return const_cast<std::remove_cv_t<U>*>(casted);
+  } else {
+    void* handle = ref_count_ptr_access::handle(ptr);
+    // Control blocks point at the object as it was created, which a cast
+    // through multiple inheritance can move away from.
+    if constexpr (ref_count_family_of<U>() ==
+                  ref_count_family::control_block) {
+      if (ref_count_traits<U>::resolve(handle) != casted) {
+        return nullptr;
+      }
+    }
+    return handle;
+  }
+}
+
+template <typename U, typename T>
+ref_count_ptr<U> share_ref_cast(const ref_count_ptr<T>& ptr,
+                                U* casted) noexcept {
+  void* handle = ref_cast_handle(ptr, casted);
+  if (!handle) {
+    return nullptr;
+  }
+  ref_count_traits<U>::add_ref(handle);
+  return ref_count_ptr_access::adopt<U>(handle);
+}
+
+// Moves the reference over, without touching the count. ptr is left intact
+// when nothing is cast.
+template <typename U, typename T>
+ref_count_ptr<U> take_ref_cast(ref_count_ptr<T>& ptr, U* casted) noexcept {
+  void* handle = ref_cast_handle(ptr, casted);
+  if (!handle) {
+    return nullptr;
+  }
+  ref_count_ptr_access::take(ptr);
+  return ref_count_ptr_access::adopt<U>(handle);
+}
+}  // namespace details_
+
+// Objects managed through a control block are only known by the address they
+// were created with. Casting them to a type found at another address, through
+// multiple or virtual inheritance, cannot be expressed: dynamic_ref_cast()
+// fails, and static_ref_cast() violates its precondition.
+
+// ********** static_ref_cast() **********
+template <typename U, typename T>
+ref_count_ptr<U> static_ref_cast(const ref_count_ptr<T>& ptr) noexcept {
+  auto result = details_::share_ref_cast(ptr, static_cast<U*>(ptr.get()));
+  precondition(result || !ptr, "cast moves away from the control block");
+  return result;
+}
+
+template <typename U, typename T>
+ref_count_ptr<U> static_ref_cast(ref_count_ptr<T>&& ptr) noexcept {
+  auto result = details_::take_ref_cast(ptr, static_cast<U*>(ptr.get()));
+  precondition(result || !ptr, "cast moves away from the control block");
+  return result;
+}
+
+// ********** dynamic_ref_cast() **********
+template <typename U, typename T>
+ref_count_ptr<U> dynamic_ref_cast(const ref_count_ptr<T>& ptr) noexcept {
+  return details_::share_ref_cast(ptr, dynamic_cast<U*>(ptr.get()));
+}
+
+// A failed cast leaves ptr untouched.
+template <typename U, typename T>
+ref_count_ptr<U> dynamic_ref_cast(ref_count_ptr<T>&& ptr) noexcept {
+  return details_::take_ref_cast(ptr, dynamic_cast<U*>(ptr.get()));
+}
+
+// ********** const_ref_cast() **********
+template <typename U, typename T>
+ref_count_ptr<U> const_ref_cast(const ref_count_ptr<T>& ptr) noexcept {
+  return details_::share_ref_cast(ptr, const_cast<U*>(ptr.get()));
+}
+
+template <typename U, typename T>
+ref_count_ptr<U> const_ref_cast(ref_count_ptr<T>&& ptr) noexcept {
+  return details_::take_ref_cast(ptr, const_cast<U*>(ptr.get()));
+}
+
+template <class T, class U>
+bool operator==(const ref_count_ptr<T>& lhs,
+                const ref_count_ptr<U>& rhs) noexcept {
+  return lhs.get() == rhs.get();
+}
+
+template <class T>
+bool operator==(const ref_count_ptr<T>& lhs, std::nullptr_t) noexcept {
+  return !lhs;
+}
+
+template <class T, class U>
+std::strong_ordering operator<=>(const ref_count_ptr<T>& lhs,
+                                 const ref_count_ptr<U>& rhs) noexcept {
+  return std::compare_three_way{}(lhs.get(), rhs.get());
+}
+
+template <class T>
+std::strong_ordering operator<=>(const ref_count_ptr<T>& lhs,
+                                 std::nullptr_t) noexcept {
+  return std::compare_three_way{}(
+      lhs.get(),
+      static_cast<typename ref_count_ptr<T>::element_type*>(nullptr));
+}
+
+}  // namespace abu::mem
+
 #endif
\ No newline at end of file
@@ -0,0 +1,339 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_REF_REGION_H_INCLUDED
+#define ABU_MEM_REF_REGION_H_INCLUDED
+
+#include <algorithm>
+#include <climits>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+// Base of types that live in a ref_region. It adds nothing to the object: the
+// reference count belongs to the region the object was made in.
+//
+// Such objects can only be created by ref_region::make<T>().
+class region_allocated {
+ public:
+  static void* operator new(std::size_t) = delete;
+  static void* operator new[](std::size_t) = delete;
+
+ protected:
+  region_allocated() = default;
+  region_allocated(const region_allocated&) = default;
+  region_allocated(region_allocated&&) = default;
+  region_allocated& operator=(const region_allocated&) = default;
+  region_allocated& operator=(region_allocated&&) = default;
+
+  // Not virtual on purpose.
+  ~region_allocated() = default;
+};
+
+namespace details_ {
+
+// Regions are made of chunks of whole pages. Every page starts with the region
+// it belongs to, so that the region of any object can be found from its
+// address alone.
+inline constexpr std::size_t region_page_size = 4 * 1024;
+
+// Chunks start at a single page, and grow with the region up to this size.
+inline constexpr std::size_t region_max_chunk_size = 64 * 1024;
+
+// Past this, an object could start beyond the first page of its own chunk.
+inline constexpr std::size_t region_max_alignment = region_page_size / 2;
+
+struct region_state;
+
+struct region_page {
+  region_state* region;
+
+  static region_page* of(const void* obj) noexcept {
+    auto addr = reinterpret_cast<std::uintptr_t>(obj);
+    return reinterpret_cast<region_page*>(addr & ~(region_page_size - 1));
+  }
+};
+
+struct region_chunk {
+  region_page page;
+  region_chunk* next;
+  std::size_t size;
+};
+
+// Destroys an object when its region is released.
+struct region_finalizer {
+  void (*destroy)(void* obj) noexcept;
+  void* obj;
+  region_finalizer* next;
+};
+
+template <typename T>
+void destroy_region_object(void* obj) noexcept {
+  std::destroy_at(static_cast<T*>(obj));
+}
+
+struct region_state : borrow_count<> {
+  region_state() = default;
+  region_state(const region_state&) = delete;
+  region_state(region_state&&) = delete;
+  region_state& operator=(const region_state&) = delete;
+  region_state& operator=(region_state&&) = delete;
+
+  ~region_state() {
+    while (chunks) {
+      region_chunk* next = chunks->next;
+      ::operator delete(static_cast<void*>(chunks),
+                        chunks->size,
+                        std::align_val_t{region_page_size});
+      chunks = next;
+    }
+  }
+
+  static region_state* of(const void* obj) noexcept {
+    return region_page::of(obj)->region;
+  }
+
+  void* allocate(std::size_t size, std::size_t alignment) {
+    assume(alignment <= region_max_alignment);
+
+    if (void* result = bump_(size, alignment)) {
+      return result;
+    }
+
+    std::size_t start = align_up(sizeof(region_chunk), alignment);
+    if (start + size > region_page_size) {
+      // Objects that do not fit in a page get a chunk of their own, so that
+      // the current page keeps being filled.
+      return add_chunk_(align_up(start + size, region_page_size)) + start;
+    }
+
+    std::byte* page = page_end;
+    if (page == chunk_end) {
+      std::size_t chunk_size =
+          std::clamp(reserved, region_page_size, region_max_chunk_size);
+      page = add_chunk_(chunk_size);
+      chunk_end = page + chunk_size;
+      cursor = page + sizeof(region_chunk);
+    } else {
+      ::new (static_cast<void*>(page)) region_page{this};
+      cursor = page + sizeof(region_page);
+    }
+    page_end = page + region_page_size;
+
+    return bump_(size, alignment);
+  }
+
+  // Destroys every object, and hands back all the memory in one go.
+  void release() noexcept {
+    // Objects can hold references to each other, and dropping them must not
+    // trigger a second release.
+    ref_count = LONG_MAX / 2;
+
+    while (finalizers) {
+      region_finalizer* f = finalizers;
+      finalizers = f->next;
+      f->destroy(f->obj);
+    }
+
+    borrow_check(!has_borrows(), "ref_view outlived its region");
+    delete this;
+  }
+
+  long ref_count = 1;
+  region_chunk* chunks = nullptr;
+  std::size_t reserved = 0;
+  std::byte* cursor = nullptr;
+  std::byte* page_end = nullptr;
+  std::byte* chunk_end = nullptr;
+  region_finalizer* finalizers = nullptr;
+
+ private:
+  // Allocates from the current page, if it has room.
+  void* bump_(std::size_t size, std::size_t alignment) noexcept {
+    auto addr = reinterpret_cast<std::uintptr_t>(cursor);
+    auto end = reinterpret_cast<std::uintptr_t>(page_end);
+    std::uintptr_t start = align_up(addr, alignment);
+    if (!cursor || start > end || end - start < size) {
+      return nullptr;
+    }
+
+    std::byte* result = cursor + (start - addr);
+    cursor = result + size;
+    return result;
+  }
+
+  std::byte* add_chunk_(std::size_t size) {
+    void* mem = ::operator new(size, std::align_val_t{region_page_size});
+    chunks = ::new (mem) region_chunk{{this}, chunks, size};
+    reserved += size;
+    return static_cast<std::byte*>(mem);
+  }
+};
+
+inline void remove_region_ref(region_state* region) noexcept {
+  assume(region->ref_count > 0);
+  region->ref_count -= 1;
+  if (region->ref_count == 0) {
+    region->release();
+  }
+}
+
+template <typename T>
+inline constexpr bool dependent_false = false;
+}  // namespace details_
+
+// Every ref_count_ptr<> to an object of a region counts against the region as
+// a whole. The shared state is the object itself.
+template <std::derived_from<region_allocated> T>
+struct ref_count_traits<T> {
+  static region_allocated* create_shared_state(T* ptr) noexcept {
+    assume(ptr);
+    region_allocated* ra = ptr;
+    details_::region_state::of(ra)->ref_count += 1;
+    return ra;
+  }
+
+  static void add_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::region_state::of(shared_state)->ref_count += 1;
+  }
+
+  static void remove_ref(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::remove_region_ref(details_::region_state::of(shared_state));
+  }
+
+  static void add_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::region_state::of(shared_state)->add_borrow();
+  }
+
+  static void remove_borrow(void* shared_state) noexcept {
+    assume(shared_state);
+    details_::region_state::of(shared_state)->remove_borrow();
+  }
+
+  // Number of owners of the whole region.
+  static long use_count(void* shared_state) noexcept {
+    assume(shared_state);
+    return details_::region_state::of(shared_state)->ref_count;
+  }
+
+  static T* resolve(void* shared_state) noexcept {
+    return static_cast<T*>(static_cast<region_allocated*>(shared_state));
+  }
+
+  template <typename... Args>
+  static void* make_obj_and_shared_state(Args&&...) {
+    static_assert(details_::dependent_false<T>,
+                  "region_allocated types are created by ref_region::make()");
+    return nullptr;
+  }
+};
+
+// A group of objects that share a single reference count and are released
+// together, in one operation, once the region and every ref_count_ptr<> to
+// any of its objects are gone.
+//
+// Objects are destroyed in the reverse order of their creation. Links between
+// objects of the same region should be ref_view<> or raw pointers: a
+// ref_count_ptr<> stored inside a region keeps that region alive.
+class ref_region {
+ public:
+  ref_region() : state_(new details_::region_state) {}
+
+  ref_region(const ref_region& other) noexcept : state_(other.state_) {
+    if (state_) {
+      state_->ref_count += 1;
+    }
+  }
+
+  ref_region(ref_region&& other) noexcept
+      : state_(std::exchange(other.state_, nullptr)) {}
+
+  ref_region& operator=(const ref_region& rhs) noexcept {
+    ref_region tmp(rhs);
+    std::swap(state_, tmp.state_);
+    return *this;
+  }
+
+  ref_region& operator=(ref_region&& rhs) noexcept {
+    ref_region tmp(std::move(rhs));
+    std::swap(state_, tmp.state_);
+    return *this;
+  }
+
+  ~ref_region() {
+    if (state_) {
+      details_::remove_region_ref(state_);
+    }
+  }
+
+  // Creates a T in the region.
+  template <std::derived_from<region_allocated> T, typename... Args>
+  ref_count_ptr<T> make(Args&&... args) {
+    static_assert(alignof(T) <= details_::region_max_alignment,
+                  "over-aligned for a ref_region");
+    precondition(state_, "using a moved-from region");
+
+    void* storage = state_->allocate(sizeof(T), alignof(T));
+
+    details_::region_finalizer* finalizer = nullptr;
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      finalizer = static_cast<details_::region_finalizer*>(
+          state_->allocate(sizeof(details_::region_finalizer),
+                           alignof(details_::region_finalizer)));
+    }
+
+    // If construction fails, the storage is simply left unused.
+    T* obj = ::new (storage) T(std::forward<Args>(args)...);
+
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      state_->finalizers = ::new (static_cast<void*>(finalizer))
+          details_::region_finalizer{
+              &details_::destroy_region_object<T>, obj, state_->finalizers};
+    }
+
+    state_->ref_count += 1;
+    return details_::ref_count_ptr_access::adopt<T>(
+        static_cast<region_allocated*>(obj));
+  }
+
+  // Number of owners of the region: the region handles themselves, and every
+  // ref_count_ptr<> to one of its objects.
+  long use_count() const noexcept {
+    return state_ ? state_->ref_count : 0;
+  }
+
+  // Bytes of memory held by the region, objects and bookkeeping included.
+  std::size_t reserved_bytes() const noexcept {
+    return state_ ? state_->reserved : 0;
+  }
+
+ private:
+  details_::region_state* state_;
+};
+
+}  // namespace abu::mem
+
+#endif
@@ -0,0 +1,183 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_REF_VIEW_H_INCLUDED
+#define ABU_MEM_REF_VIEW_H_INCLUDED
+
+#include <compare>
+#include <concepts>
+#include <cstddef>
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+template <typename T>
+class ref_view;
+
+namespace details_ {
+
+// Untracked views are nothing more than the shared state's address.
+template <typename T, bool Tracked = borrow_tracking>
+class ref_view_storage {
+ protected:
+  ref_view_storage() = default;
+  explicit ref_view_storage(void* shared_state) noexcept
+      : shared_state_(shared_state) {}
+
+  void* shared_state_ = nullptr;
+};
+
+// Tracked views register themselves with the shared state, so that the
+// release of the last owner can tell if anything is still borrowing it.
+template <typename T>
+class ref_view_storage<T, true> {
+ protected:
+  ref_view_storage() = default;
+  explicit ref_view_storage(void* shared_state) noexcept
+      : shared_state_(shared_state) {
+    borrow_();
+  }
+
+  ref_view_storage(const ref_view_storage& other) noexcept
+      : shared_state_(other.shared_state_) {
+    borrow_();
+  }
+
+  ref_view_storage& operator=(const ref_view_storage& rhs) noexcept {
+    if (this != &rhs) {
+      unborrow_();
+      shared_state_ = rhs.shared_state_;
+      borrow_();
+    }
+    return *this;
+  }
+
+  ~ref_view_storage() {
+    unborrow_();
+  }
+
+  void* shared_state_ = nullptr;
+
+ private:
+  void borrow_() noexcept {
+    if (shared_state_) {
+      ref_count_traits<T>::add_borrow(shared_state_);
+    }
+  }
+
+  void unborrow_() noexcept {
+    if (shared_state_) {
+      ref_count_traits<T>::remove_borrow(shared_state_);
+    }
+  }
+};
+}  // namespace details_
+
+// Non-owning reference to an object managed by ref_count_ptr<>.
+//
+// Meant to be passed by value down call chains where the callee does not need
+// to share ownership. When borrows are tracked (see borrow_check_lvl), the
+// release of the last owner while a view is still alive is reported.
+// Otherwise, ref_view is trivially copyable and the size of a raw pointer.
+template <typename T>
+class ref_view : details_::ref_view_storage<T> {
+  using storage_type = details_::ref_view_storage<T>;
+
+ public:
+  using element_type = T;
+
+  // ********** Constructors **********
+  ref_view() noexcept = default;
+  ref_view(std::nullptr_t) noexcept {}
+
+  ref_view(const ref_count_ptr<T>& owner) noexcept
+      : storage_type(details_::ref_count_ptr_access::handle(owner)) {}
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_view(const ref_count_ptr<Y>& owner) noexcept
+      : storage_type(details_::rebind_handle<T, Y>(
+            details_::ref_count_ptr_access::handle(owner))) {}
+
+  // A view of a temporary would dangle right away.
+  ref_view(ref_count_ptr<T>&&) = delete;
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_view(ref_count_ptr<Y>&&) = delete;
+
+  template <details_::ref_convertible_to<T> Y>
+  ref_view(const ref_view<Y>& other) noexcept
+      : storage_type(details_::rebind_handle<T, Y>(other.shared_state_)) {}
+
+  // ********** get() **********
+  element_type* get() const noexcept {
+    if (this->shared_state_) {
+      return ref_count_traits<T>::resolve(this->shared_state_);
+    }
+    return nullptr;
+  }
+
+  // ********** operator*() **********
+  T& operator*() const noexcept {
+    precondition(this->shared_state_, "accessing null view");
+
+    return *ref_count_traits<T>::resolve(this->shared_state_);
+  }
+
+  // ********** operator->() **********
+  T* operator->() const noexcept {
+    precondition(this->shared_state_, "accessing null view");
+
+    return ref_count_traits<T>::resolve(this->shared_state_);
+  }
+
+  // ********** operator bool() **********
+  explicit operator bool() const noexcept {
+    return this->shared_state_ != nullptr;
+  }
+
+  // ********** promote() **********
+  // Creates a new owner of the viewed object.
+  ref_count_ptr<T> promote() const noexcept {
+    if (this->shared_state_) {
+      ref_count_traits<T>::add_ref(this->shared_state_);
+    }
+    return details_::ref_count_ptr_access::adopt<T>(this->shared_state_);
+  }
+
+ private:
+  template <typename U>
+  friend class ref_view;
+};
+
+template <class T, class U>
+bool operator==(const ref_view<T>& lhs, const ref_view<U>& rhs) noexcept {
+  return lhs.get() == rhs.get();
+}
+
+template <class T>
+bool operator==(const ref_view<T>& lhs, std::nullptr_t) noexcept {
+  return !lhs;
+}
+
+template <class T, class U>
+std::strong_ordering operator<=>(const ref_view<T>& lhs,
+                                 const ref_view<U>& rhs) noexcept {
+  return std::compare_three_way{}(lhs.get(), rhs.get());
+}
+
+}  // namespace abu::mem
+
+#endif
@@ -0,0 +1,790 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_SNAPSHOT_H_INCLUDED
+#define ABU_MEM_SNAPSHOT_H_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+class snapshot_writer;
+class snapshot_reader;
+class snapshot;
+
+// Customization point describing how nodes of type T are stored.
+//
+// Trivially copyable types need nothing: they are stored as-is and used in
+// place once loaded. Other types must provide:
+//
+//   static void save(snapshot_writer& w, const T& obj);
+//   static ref_count_ptr<T> load(snapshot_reader& r);
+//
+// load() must read back exactly what save() wrote, in the same order.
+// References are not loaded right away: read_ref() fills them in once load()
+// has returned, which lets loading run without recursion and handle cycles.
+template <typename T>
+struct snapshot_traits {};
+
+template <typename T>
+concept custom_snapshot_node =
+    requires(snapshot_writer& w, snapshot_reader& r, const T& obj) {
+  snapshot_traits<T>::save(w, obj);
+  { snapshot_traits<T>::load(r) } -> std::same_as<ref_count_ptr<T>>;
+};
+
+// In-place nodes are given a control block when loaded, which types holding
+// their own count cannot use.
+template <typename T>
+concept in_place_snapshot_node = !custom_snapshot_node<T> &&
+                                 !std::derived_from<T, region_allocated> &&
+                                 !details_::foreign_ref_counted<T> &&
+                                 std::is_trivially_copyable_v<T>;
+
+// Objects of a ref_region share their region's count, so the writer cannot
+// tell which of them are shared.
+template <typename T>
+concept snapshot_node = !std::derived_from<T, region_allocated> &&
+                        (custom_snapshot_node<T> || in_place_snapshot_node<T>);
+
+namespace details_ {
+
+// All offsets are from the start of the snapshot, which makes it relocatable.
+// 0 is used as the null reference.
+struct snapshot_header {
+  std::array<char, 8> magic;
+  std::uint64_t version;
+  std::uint64_t size;
+  std::uint64_t root;
+  std::uint64_t shared_count;
+};
+
+struct snapshot_record_header {
+  std::uint64_t payload_size;
+  // 0 for nodes referenced only once, index + 1 in the shared table otherwise.
+  std::uint64_t shared_slot;
+};
+
+inline constexpr std::array<char, 8> snapshot_magic = {
+    'a', 'b', 'u', '.', 's', 'n', 'a', 'p'};
+inline constexpr std::uint64_t snapshot_version = 1;
+inline constexpr std::size_t snapshot_record_alignment = 16;
+inline constexpr std::size_t snapshot_max_alignment = 64;
+inline constexpr std::size_t snapshot_first_record =
+    align_up(sizeof(snapshot_header), snapshot_record_alignment);
+
+template <typename T>
+constexpr std::size_t snapshot_record_alignment_of() {
+  return std::max(snapshot_record_alignment, alignof(T));
+}
+
+template <typename T>
+constexpr std::size_t snapshot_payload_offset() {
+  if constexpr (in_place_snapshot_node<T>) {
+    return align_up(sizeof(snapshot_record_header), alignof(T));
+  } else {
+    return sizeof(snapshot_record_header);
+  }
+}
+
+// The memory backing a loaded snapshot, kept alive by everything that
+// references it.
+class snapshot_image : public ref_counted {
+ public:
+  snapshot_image(std::byte* data,
+                 std::size_t size,
+                 void (*release)(std::byte*, std::size_t) noexcept)
+      : data_(data), size_(size), release_(release) {}
+
+  snapshot_image(const snapshot_image&) = delete;
+  snapshot_image(snapshot_image&&) = delete;
+  snapshot_image& operator=(const snapshot_image&) = delete;
+  snapshot_image& operator=(snapshot_image&&) = delete;
+
+  ~snapshot_image() {
+    release_(data_, size_);
+  }
+
+  std::byte* data() const noexcept {
+    return data_;
+  }
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+
+ private:
+  std::byte* data_;
+  std::size_t size_;
+  void (*release_)(std::byte*, std::size_t) noexcept;
+};
+
+// Control block of a node used in place. It does not own the node, only the
+// image holding it.
+struct mapped_shared_state final : basic_shared_state {
+  mapped_shared_state(void* obj, ref_count_ptr<snapshot_image> img)
+      : image(std::move(img)) {
+    ptr = obj;
+  }
+
+  mapped_shared_state(const mapped_shared_state&) = delete;
+  mapped_shared_state(mapped_shared_state&&) = delete;
+  mapped_shared_state& operator=(const mapped_shared_state&) = delete;
+  mapped_shared_state& operator=(mapped_shared_state&&) = delete;
+  ~mapped_shared_state() = default;
+
+  ref_count_ptr<snapshot_image> image;
+};
+
+// Snapshots are external input: their contents are always validated.
+[[noreturn]] inline void throw_corrupt_snapshot(const char* what) {
+  throw std::runtime_error(std::string("corrupt snapshot: ") + what);
+}
+
+// Identifies the type a shared node was materialized as.
+template <typename T>
+inline constexpr char snapshot_type_key = 0;
+
+[[noreturn]] inline void throw_last_system_error(const char* what) {
+#if defined(_WIN32)
+  throw std::system_error(
+      static_cast<int>(GetLastError()), std::system_category(), what);
+#else
+  throw std::system_error(errno, std::system_category(), what);
+#endif
+}
+}  // namespace details_
+
+// Serializes a graph of ref_count_ptr<> linked nodes. Nodes reachable through
+// several references are only written once.
+class snapshot_writer {
+ public:
+  snapshot_writer(const snapshot_writer&) = delete;
+  snapshot_writer(snapshot_writer&&) = delete;
+  snapshot_writer& operator=(const snapshot_writer&) = delete;
+  snapshot_writer& operator=(snapshot_writer&&) = delete;
+  ~snapshot_writer() = default;
+
+  template <snapshot_node T>
+  static std::vector<std::byte> save(const ref_count_ptr<T>& root) {
+    snapshot_writer writer;
+    writer.data_.resize(details_::snapshot_first_record);
+    writer.write_ref_at_(offsetof(details_::snapshot_header, root), root);
+    writer.run_();
+    return std::move(writer.data_);
+  }
+
+  // ********** write() **********
+  template <typename U>
+    requires std::is_trivially_copyable_v<U>
+  void write(const U& value) {
+    write_bytes(std::as_bytes(std::span<const U, 1>(&value, 1)));
+  }
+
+  void write_bytes(std::span<const std::byte> bytes) {
+    data_.insert(data_.end(), bytes.begin(), bytes.end());
+  }
+
+  // ********** write_ref() **********
+  template <snapshot_node U>
+  void write_ref(const ref_count_ptr<U>& ref) {
+    std::size_t pos = data_.size();
+    data_.resize(pos + sizeof(std::uint64_t));
+    write_ref_at_(pos, ref);
+  }
+
+ private:
+  static constexpr std::uint32_t not_tracked = ~std::uint32_t{0};
+
+  using save_fn = std::uint64_t (*)(snapshot_writer&, void*);
+
+  struct pending_node {
+    void* shared_state;
+    save_fn save;
+    std::size_t ref_pos;
+    std::uint32_t tracked;
+  };
+
+  struct tracked_node {
+    std::uint64_t offset = 0;
+    std::uint64_t refs = 1;
+  };
+
+  struct deferred_ref {
+    std::size_t ref_pos;
+    std::uint32_t tracked;
+  };
+
+  snapshot_writer() = default;
+
+  template <snapshot_node U>
+  void write_ref_at_(std::size_t pos, const ref_count_ptr<U>& ref) {
+    if (!ref) {
+      patch_(pos, 0);
+      return;
+    }
+
+    void* shared_state = details_::ref_count_ptr_access::handle(ref);
+
+    // A node with a single owner cannot be reached again.
+    std::uint32_t tracked = not_tracked;
+    if (ref.use_count() > 1) {
+      auto [found, inserted] = tracked_index_.try_emplace(
+          shared_state, static_cast<std::uint32_t>(tracked_.size()));
+      tracked = found->second;
+      if (!inserted) {
+        tracked_node& node = tracked_[tracked];
+        node.refs += 1;
+        if (node.offset != 0) {
+          patch_(pos, node.offset);
+        } else {
+          deferred_.push_back({pos, tracked});
+        }
+        return;
+      }
+      tracked_.emplace_back();
+    }
+
+    pending_.push_back({shared_state, &save_node_<U>, pos, tracked});
+  }
+
+  template <snapshot_node U>
+  static std::uint64_t save_node_(snapshot_writer& w, void* shared_state) {
+    const U& obj = *ref_count_traits<U>::resolve(shared_state);
+
+    std::size_t record = details_::align_up(
+        w.data_.size(), details_::snapshot_record_alignment_of<U>());
+    std::size_t payload = record + details_::snapshot_payload_offset<U>();
+    w.data_.resize(payload);
+
+    if constexpr (in_place_snapshot_node<U>) {
+      static_assert(alignof(U) <= details_::snapshot_max_alignment);
+      w.write_in_place_(obj);
+    } else {
+      snapshot_traits<U>::save(w, obj);
+    }
+
+    details_::snapshot_record_header header{w.data_.size() - payload, 0};
+    std::memcpy(w.data_.data() + record, &header, sizeof(header));
+    return record;
+  }
+
+  // Writes obj with its padding bytes zeroed, so that equal graphs produce
+  // identical snapshots and no indeterminate bytes end up in the image.
+  template <in_place_snapshot_node U>
+  void write_in_place_(const U& obj) {
+    alignas(U) std::byte copy[sizeof(U)];
+    std::memcpy(copy, &obj, sizeof(U));
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_clear_padding)
+    __builtin_clear_padding(std::launder(reinterpret_cast<U*>(copy)));
+#endif
+#endif
+    write_bytes(copy);
+  }
+
+  void run_() {
+    while (!pending_.empty()) {
+      pending_node node = pending_.front();
+      pending_.pop_front();
+
+      std::uint64_t offset = node.save(*this, node.shared_state);
+      patch_(node.ref_pos, offset);
+      if (node.tracked != not_tracked) {
+        tracked_[node.tracked].offset = offset;
+      }
+    }
+
+    for (const auto& ref : deferred_) {
+      patch_(ref.ref_pos, tracked_[ref.tracked].offset);
+    }
+
+    std::uint64_t shared_count = 0;
+    for (const auto& node : tracked_) {
+      if (node.refs > 1) {
+        shared_count += 1;
+        std::memcpy(data_.data() + node.offset +
+                        offsetof(details_::snapshot_record_header, shared_slot),
+                    &shared_count,
+                    sizeof(shared_count));
+      }
+    }
+
+    details_::snapshot_header header{details_::snapshot_magic,
+                                     details_::snapshot_version,
+                                     data_.size(),
+                                     0,
+                                     shared_count};
+    std::memcpy(&header.root,
+                data_.data() + offsetof(details_::snapshot_header, root),
+                sizeof(header.root));
+    std::memcpy(data_.data(), &header, sizeof(header));
+  }
+
+  void patch_(std::size_t pos, std::uint64_t offset) noexcept {
+    std::memcpy(data_.data() + pos, &offset, sizeof(offset));
+  }
+
+  std::vector<std::byte> data_;
+  std::deque<pending_node> pending_;
+  std::unordered_map<void*, std::uint32_t> tracked_index_;
+  std::vector<tracked_node> tracked_;
+  std::vector<deferred_ref> deferred_;
+};
+
+// Reads the payload of a single node, in the order it was written.
+class snapshot_reader {
+ public:
+  snapshot_reader(const snapshot_reader&) = delete;
+  snapshot_reader(snapshot_reader&&) = delete;
+  snapshot_reader& operator=(const snapshot_reader&) = delete;
+  snapshot_reader& operator=(snapshot_reader&&) = delete;
+  ~snapshot_reader() = default;
+
+  // ********** read() **********
+  template <typename U>
+    requires std::is_trivially_copyable_v<U> && std::is_default_constructible_v<U>
+  U read() {
+    U result;
+    std::memcpy(&result, read_bytes(sizeof(U)).data(), sizeof(U));
+    return result;
+  }
+
+  // The returned bytes live in the snapshot image.
+  std::span<const std::byte> read_bytes(std::size_t count) {
+    if (count > remaining_.size()) {
+      details_::throw_corrupt_snapshot("reading past end of node");
+    }
+    auto result = remaining_.first(count);
+    remaining_ = remaining_.subspan(count);
+    return result;
+  }
+
+  // ********** read_ref() **********
+  // dst is assigned after load() returns. It must stay where it is until then,
+  // which is the case for members of the node being loaded.
+  template <snapshot_node U>
+  void read_ref(ref_count_ptr<U>& dst);
+
+  // Access to an in-place node without creating a control block for it. The
+  // result is valid as long as the snapshot image is alive.
+  template <in_place_snapshot_node U>
+  U* read_in_place_ref();
+
+ private:
+  friend class snapshot;
+
+  snapshot_reader(snapshot& owner, std::span<const std::byte> payload)
+      : owner_(owner), remaining_(payload) {}
+
+  std::uint64_t read_offset_() {
+    return read<std::uint64_t>();
+  }
+
+  snapshot& owner_;
+  std::span<const std::byte> remaining_;
+};
+
+// A loaded snapshot.
+//
+// Nodes are materialized on demand, starting from root(). The root and nodes
+// referenced from several places are cached by the snapshot so that they stay
+// shared, and in-place nodes only get a control block once something
+// references them.
+class snapshot {
+ public:
+  snapshot(const snapshot&) = delete;
+  snapshot(snapshot&&) noexcept = default;
+  snapshot& operator=(const snapshot&) = delete;
+  snapshot& operator=(snapshot&&) = delete;
+
+  ~snapshot() {
+    for (const auto& node : shared_) {
+      if (node.shared_state) {
+        node.release(node.shared_state);
+      }
+    }
+  }
+
+  // Loads a copy of bytes previously produced by snapshot_writer::save().
+  static snapshot copy_of(std::span<const std::byte> bytes) {
+    auto release = +[](std::byte* data, std::size_t) noexcept {
+      ::operator delete(
+          data, std::align_val_t{details_::snapshot_max_alignment});
+    };
+
+    auto data = static_cast<std::byte*>(::operator new(
+        bytes.size(), std::align_val_t{details_::snapshot_max_alignment}));
+    std::memcpy(data, bytes.data(), bytes.size());
+
+    return snapshot(make_ref_counted<details_::snapshot_image>(
+        data, bytes.size(), release));
+  }
+
+  // Maps a snapshot file in memory. In-place nodes are used straight from the
+  // mapping, which is private: writes to them never reach the file.
+  static snapshot map_file(const std::filesystem::path& path) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      details_::throw_last_system_error("opening snapshot");
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+      CloseHandle(file);
+      details_::throw_last_system_error("reading snapshot size");
+    }
+
+    HANDLE mapping =
+        CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+      details_::throw_last_system_error("mapping snapshot");
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) {
+      details_::throw_last_system_error("mapping snapshot");
+    }
+
+    auto release = +[](std::byte* d, std::size_t) noexcept {
+      UnmapViewOfFile(d);
+    };
+    auto size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      details_::throw_last_system_error("opening snapshot");
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      details_::throw_last_system_error("reading snapshot size");
+    }
+
+    auto size = static_cast<std::size_t>(st.st_size);
+    void* data = ::mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      details_::throw_last_system_error("mapping snapshot");
+    }
+
+    auto release = +[](std::byte* d, std::size_t s) noexcept {
+      ::munmap(d, s);
+    };
+#endif
+    return snapshot(make_ref_counted<details_::snapshot_image>(
+        static_cast<std::byte*>(data), size, release));
+  }
+
+  // ********** root() **********
+  // The snapshot holds on to the root it loads, so that repeated calls return
+  // the same graph instead of loading it again.
+  template <snapshot_node T>
+  ref_count_ptr<T> root() {
+    shared_node& cached = shared_[0];
+    if (cached.type == &details_::snapshot_type_key<T>) {
+      return reuse_<T>(cached);
+    }
+
+    ref_count_ptr<T> result;
+    defer_(header_().root, result);
+    run_();
+
+    if (result && !cached.shared_state) {
+      remember_(cached, header_().root, result);
+    }
+    return result;
+  }
+
+ private:
+  friend class snapshot_reader;
+
+  struct shared_node {
+    void* shared_state = nullptr;
+    void (*release)(void*) noexcept = nullptr;
+    std::uint64_t offset = 0;
+    const void* type = nullptr;
+  };
+
+  struct record {
+    details_::snapshot_record_header header;
+    std::byte* payload;
+  };
+
+  // A reference read by a node, waiting for its target to be loaded.
+  struct pending_ref {
+    std::uint64_t offset;
+    void* dst;
+    void (*fill)(snapshot&, std::uint64_t, void*);
+  };
+
+  explicit snapshot(ref_count_ptr<details_::snapshot_image> image)
+      : image_(std::move(image)) {
+    details_::snapshot_header header;
+    if (image_->size() < sizeof(header)) {
+      throw std::runtime_error("truncated snapshot");
+    }
+
+    header = header_();
+    if (header.magic != details_::snapshot_magic ||
+        header.version != details_::snapshot_version) {
+      throw std::runtime_error("not a snapshot");
+    }
+    if (header.size > image_->size() ||
+        header.size < details_::snapshot_first_record) {
+      throw std::runtime_error("truncated snapshot");
+    }
+
+    // Every shared node takes up at least one record.
+    if (header.shared_count >
+        header.size / details_::snapshot_record_alignment) {
+      details_::throw_corrupt_snapshot("bad shared node count");
+    }
+
+    size_ = header.size;
+    // Slot 0 is the root, shared nodes use the following ones.
+    shared_.resize(header.shared_count + 1);
+  }
+
+  details_::snapshot_header header_() const noexcept {
+    details_::snapshot_header header;
+    std::memcpy(&header, image_->data(), sizeof(header));
+    return header;
+  }
+
+  template <snapshot_node T>
+  void defer_(std::uint64_t offset, ref_count_ptr<T>& dst) {
+    if (offset == 0) {
+      dst.reset();
+      return;
+    }
+
+    pending_.push_back({offset, &dst, &fill_<T>});
+  }
+
+  template <snapshot_node T>
+  static void fill_(snapshot& snap, std::uint64_t offset, void* dst) {
+    *static_cast<ref_count_ptr<T>*>(dst) = snap.materialize_<T>(offset);
+  }
+
+  void run_() {
+    // Outside of shared nodes, which are cached, a record is materialized at
+    // most once. Going over that means the references loop.
+    load_budget_ = size_ / details_::snapshot_record_alignment;
+
+    try {
+      while (!pending_.empty()) {
+        pending_ref ref = pending_.back();
+        pending_.pop_back();
+        ref.fill(*this, ref.offset, ref.dst);
+      }
+    } catch (...) {
+      pending_.clear();
+      throw;
+    }
+  }
+
+  // Locates the record of a T, rejecting anything that does not lie entirely
+  // within the snapshot.
+  template <snapshot_node T>
+  record record_at_(std::uint64_t offset) const {
+    constexpr std::size_t payload_offset =
+        details_::snapshot_payload_offset<T>();
+
+    if (offset < details_::snapshot_first_record || offset > size_ ||
+        size_ - offset < payload_offset) {
+      details_::throw_corrupt_snapshot("reference out of bounds");
+    }
+    if (offset % details_::snapshot_record_alignment_of<T>() != 0) {
+      details_::throw_corrupt_snapshot("misaligned reference");
+    }
+
+    record result;
+    std::memcpy(&result.header, image_->data() + offset, sizeof(result.header));
+    if (result.header.payload_size > size_ - offset - payload_offset) {
+      details_::throw_corrupt_snapshot("node out of bounds");
+    }
+    if constexpr (in_place_snapshot_node<T>) {
+      if (result.header.payload_size != sizeof(T)) {
+        details_::throw_corrupt_snapshot("node size mismatch");
+      }
+    }
+
+    result.payload = image_->data() + offset + payload_offset;
+    return result;
+  }
+
+  template <snapshot_node T>
+  ref_count_ptr<T> materialize_(std::uint64_t offset) {
+    if (offset == 0) {
+      return nullptr;
+    }
+
+    record rec = record_at_<T>(offset);
+
+    shared_node* cached = nullptr;
+    if (rec.header.shared_slot != 0) {
+      if (rec.header.shared_slot >= shared_.size()) {
+        details_::throw_corrupt_snapshot("bad shared slot");
+      }
+      cached = &shared_[rec.header.shared_slot];
+      if (cached->shared_state) {
+        if (cached->offset != offset ||
+            cached->type != &details_::snapshot_type_key<T>) {
+          details_::throw_corrupt_snapshot("conflicting shared node");
+        }
+        return reuse_<T>(*cached);
+      }
+    }
+
+    if (load_budget_ == 0) {
+      details_::throw_corrupt_snapshot("reference cycle");
+    }
+    load_budget_ -= 1;
+
+    ref_count_ptr<T> result;
+    if constexpr (in_place_snapshot_node<T>) {
+      gsl::owner<details_::basic_shared_state*> state =
+          new details_::mapped_shared_state(in_place_<T>(rec.payload), image_);
+      state->ref_count = 1;
+      result = details_::ref_count_ptr_access::adopt<T>(state);
+    } else {
+      snapshot_reader reader(*this, {rec.payload, rec.header.payload_size});
+      result = snapshot_traits<T>::load(reader);
+    }
+
+    if (cached && result) {
+      remember_(*cached, offset, result);
+    }
+    return result;
+  }
+
+  template <snapshot_node T>
+  static ref_count_ptr<T> reuse_(const shared_node& cached) noexcept {
+    ref_count_traits<T>::add_ref(cached.shared_state);
+    return details_::ref_count_ptr_access::adopt<T>(cached.shared_state);
+  }
+
+  // Keeps a reference to a loaded node in cached.
+  template <snapshot_node T>
+  static void remember_(shared_node& cached,
+                        std::uint64_t offset,
+                        const ref_count_ptr<T>& node) noexcept {
+    void* shared_state = details_::ref_count_ptr_access::handle(node);
+    ref_count_traits<T>::add_ref(shared_state);
+    cached = {shared_state,
+              &ref_count_traits<T>::remove_ref,
+              offset,
+              &details_::snapshot_type_key<T>};
+  }
+
+  template <in_place_snapshot_node T>
+  static T* in_place_(std::byte* payload) noexcept {
+    // Trivially copyable objects come to life along with their storage.
+    return std::launder(reinterpret_cast<T*>(payload));
+  }
+
+  template <in_place_snapshot_node T>
+  T* in_place_at_(std::uint64_t offset) {
+    if (offset == 0) {
+      return nullptr;
+    }
+    return in_place_<T>(record_at_<T>(offset).payload);
+  }
+
+  ref_count_ptr<details_::snapshot_image> image_;
+  std::uint64_t size_ = 0;
+  std::vector<shared_node> shared_;
+  std::vector<pending_ref> pending_;
+  std::uint64_t load_budget_ = 0;
+};
+
+template <snapshot_node U>
+void snapshot_reader::read_ref(ref_count_ptr<U>& dst) {
+  owner_.defer_(read_offset_(), dst);
+}
+
+template <in_place_snapshot_node U>
+U* snapshot_reader::read_in_place_ref() {
+  return owner_.in_place_at_<U>(read_offset_());
+}
+
+// ********** save_snapshot() **********
+template <snapshot_node T>
+std::vector<std::byte> save_snapshot(const ref_count_ptr<T>& root) {
+  return snapshot_writer::save(root);
+}
+
+template <snapshot_node T>
+void save_snapshot(const ref_count_ptr<T>& root,
+                   const std::filesystem::path& path) {
+  auto data = snapshot_writer::save(root);
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(data.data()),
+            static_cast<std::streamsize>(data.size()));
+  if (!out) {
+    throw std::runtime_error("failed to write snapshot " + path.string());
+  }
+}
+
+}  // namespace abu::mem
+
+#endif
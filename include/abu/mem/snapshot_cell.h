@@ -0,0 +1,195 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ABU_MEM_SNAPSHOT_CELL_H_INCLUDED
+#define ABU_MEM_SNAPSHOT_CELL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "abu/mem/check.h"
+#include "abu/mem/ref_count_ptr.h"
+
+namespace abu::mem {
+
+namespace details_ {
+inline constexpr std::size_t cache_line_size = 64;
+
+// Readers of a given epoch, on one shard. Each shard sits on its own cache
+// line so that readers on different threads never touch the same one.
+struct alignas(cache_line_size) snapshot_cell_shard {
+  std::atomic<long> readers[2] = {0, 0};
+};
+
+// Threads are spread over shards in the order they first read any cell.
+inline std::size_t this_thread_shard_index() noexcept {
+  static std::atomic<std::size_t> next_index = 0;
+  thread_local const std::size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+inline std::size_t default_snapshot_cell_shard_count() noexcept {
+  return std::bit_ceil(
+      std::max<std::size_t>(std::thread::hardware_concurrency(), 1));
+}
+}  // namespace details_
+
+// Holds the current version of a read-mostly object.
+//
+// Readers never touch a shared cache line or a reference count: they register
+// on their own thread's shard for as long as their read_guard lives. Writers
+// publish new versions, and an old version is released once every reader that
+// could still be looking at it is gone.
+//
+// ref_count_ptr<> counts are not atomic: versions are only ever copied or
+// released by writers, which the cell serializes. Readers only borrow.
+template <typename T>
+class snapshot_cell {
+ public:
+  class read_guard {
+   public:
+    read_guard(const read_guard&) = delete;
+    read_guard(read_guard&&) = delete;
+    read_guard& operator=(const read_guard&) = delete;
+    read_guard& operator=(read_guard&&) = delete;
+
+    ~read_guard() {
+      counter_->fetch_sub(1, std::memory_order_release);
+    }
+
+    const T* get() const noexcept {
+      return obj_;
+    }
+
+    const T& operator*() const noexcept {
+      precondition(obj_, "accessing null snapshot");
+      return *obj_;
+    }
+
+    const T* operator->() const noexcept {
+      precondition(obj_, "accessing null snapshot");
+      return obj_;
+    }
+
+    explicit operator bool() const noexcept {
+      return obj_ != nullptr;
+    }
+
+   private:
+    friend class snapshot_cell;
+
+    explicit read_guard(const snapshot_cell& cell) noexcept {
+      auto& shard = cell.shards_[details_::this_thread_shard_index() &
+                                 (cell.shard_count_ - 1)];
+      counter_ = &shard.readers[cell.epoch_.load(std::memory_order_seq_cst)];
+      counter_->fetch_add(1, std::memory_order_seq_cst);
+      obj_ = cell.current_.load(std::memory_order_seq_cst);
+    }
+
+    std::atomic<long>* counter_;
+    const T* obj_;
+  };
+
+  explicit snapshot_cell(
+      ref_count_ptr<T> init = nullptr,
+      std::size_t shard_count = details_::default_snapshot_cell_shard_count())
+      : shard_count_(std::bit_ceil(std::max<std::size_t>(shard_count, 1))),
+        shards_(std::make_unique<details_::snapshot_cell_shard[]>(
+            shard_count_)),
+        current_(init.get()),
+        owner_(std::move(init)) {}
+
+  snapshot_cell(const snapshot_cell&) = delete;
+  snapshot_cell(snapshot_cell&&) = delete;
+  snapshot_cell& operator=(const snapshot_cell&) = delete;
+  snapshot_cell& operator=(snapshot_cell&&) = delete;
+
+  ~snapshot_cell() {
+    assume(!has_readers_(0) && !has_readers_(1));
+  }
+
+  // The current version, valid for as long as the guard lives.
+  read_guard read() const noexcept {
+    return read_guard(*this);
+  }
+
+  // Makes next the current version. Returns once the previous version has been
+  // released, which waits for the readers that may still be using it.
+  //
+  // Must not be called while the calling thread holds a read_guard on this
+  // cell.
+  void publish(ref_count_ptr<T> next) {
+    std::lock_guard lock(write_mutex_);
+    replace_(std::move(next));
+  }
+
+  // Publishes the result of fn(current), where current is a
+  // ref_count_ptr<T>, possibly null. Concurrent updates are serialized.
+  template <typename Fn>
+  void update(Fn&& fn) {
+    std::lock_guard lock(write_mutex_);
+    replace_(std::forward<Fn>(fn)(std::as_const(owner_)));
+  }
+
+ private:
+  void replace_(ref_count_ptr<T> next) {
+    current_.store(next.get(), std::memory_order_seq_cst);
+    ref_count_ptr<T> previous = std::exchange(owner_, std::move(next));
+
+    // A reader can pick an epoch right before it flips, and register on it
+    // right after the writer saw that epoch drained. Such a reader can only
+    // see the new version, but it can still be around when the next writer
+    // flips back. Draining both epochs covers it.
+    wait_for_epoch_();
+    wait_for_epoch_();
+  }
+
+  void wait_for_epoch_() noexcept {
+    unsigned old_epoch = epoch_.load(std::memory_order_relaxed);
+    epoch_.store(old_epoch ^ 1, std::memory_order_seq_cst);
+
+    while (has_readers_(old_epoch)) {
+      std::this_thread::yield();
+    }
+  }
+
+  bool has_readers_(unsigned epoch) const noexcept {
+    for (std::size_t i = 0; i < shard_count_; ++i) {
+      if (shards_[i].readers[epoch].load(std::memory_order_seq_cst) != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::size_t shard_count_;
+  std::unique_ptr<details_::snapshot_cell_shard[]> shards_;
+
+  alignas(details_::cache_line_size) std::atomic<unsigned> epoch_ = 0;
+  std::atomic<const T*> current_;
+
+  alignas(details_::cache_line_size) std::mutex write_mutex_;
+  ref_count_ptr<T> owner_;
+};
+
+}  // namespace abu::mem
+
+#endif
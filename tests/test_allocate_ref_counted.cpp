@@ -0,0 +1,301 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+// Keeps track of what goes through it.
+class counting_resource : public std::pmr::memory_resource {
+ public:
+  explicit counting_resource(
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : upstream_(upstream) {}
+
+  std::size_t allocations = 0;
+  std::size_t deallocations = 0;
+  std::size_t bytes_in_use = 0;
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    allocations += 1;
+    bytes_in_use += bytes;
+    return upstream_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p,
+                     std::size_t bytes,
+                     std::size_t alignment) override {
+    deallocations += 1;
+    bytes_in_use -= bytes;
+    upstream_->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource* upstream_;
+};
+
+struct Tracked {
+  explicit Tracked(int& tgt) : tgt_(tgt) {
+    tgt_ = 1;
+  }
+  Tracked(const Tracked&) = delete;
+  Tracked(Tracked&&) = delete;
+  Tracked& operator=(const Tracked&) = delete;
+  Tracked& operator=(Tracked&&) = delete;
+  ~Tracked() {
+    tgt_ = 2;
+  }
+
+  int& tgt_;
+};
+
+struct IntrusiveTracked : public mem::ref_counted {
+  explicit IntrusiveTracked(int& tgt) : tgt_(tgt) {
+    tgt_ = 1;
+  }
+  IntrusiveTracked(const IntrusiveTracked&) = delete;
+  IntrusiveTracked(IntrusiveTracked&&) = delete;
+  IntrusiveTracked& operator=(const IntrusiveTracked&) = delete;
+  IntrusiveTracked& operator=(IntrusiveTracked&&) = delete;
+  ~IntrusiveTracked() {
+    tgt_ = 2;
+  }
+
+  int& tgt_;
+};
+
+// Standard allocator that fails once it has been copied a given number of
+// times.
+template <typename T>
+struct FlakyAllocator {
+  using value_type = T;
+
+  explicit FlakyAllocator(int& copies_left, long& in_use)
+      : copies_left_(&copies_left), in_use_(&in_use) {}
+
+  FlakyAllocator(const FlakyAllocator& other)
+      : FlakyAllocator(*other.copies_left_, *other.in_use_) {
+    count_copy_();
+  }
+
+  template <typename U>
+  explicit FlakyAllocator(const FlakyAllocator<U>& other)
+      : FlakyAllocator(*other.copies_left_, *other.in_use_) {
+    count_copy_();
+  }
+
+  // Moves never fail.
+  template <typename U>
+  explicit FlakyAllocator(FlakyAllocator<U>&& other) noexcept
+      : FlakyAllocator(*other.copies_left_, *other.in_use_) {}
+
+  FlakyAllocator(FlakyAllocator&&) noexcept = default;
+  FlakyAllocator& operator=(const FlakyAllocator&) = default;
+  FlakyAllocator& operator=(FlakyAllocator&&) noexcept = default;
+  ~FlakyAllocator() = default;
+
+  T* allocate(std::size_t n) {
+    *in_use_ += static_cast<long>(n);
+    return std::allocator<T>{}.allocate(n);
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    *in_use_ -= static_cast<long>(n);
+    std::allocator<T>{}.deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const FlakyAllocator<U>& other) const {
+    return in_use_ == other.in_use_;
+  }
+
+  int* copies_left_;
+  long* in_use_;
+
+ private:
+  void count_copy_() {
+    if ((*copies_left_)-- == 0) {
+      throw std::runtime_error("allocator copy");
+    }
+  }
+};
+
+struct alignas(64) OverAligned : public mem::ref_counted {
+  int v = 3;
+};
+
+TEST(allocate_ref_counted, memory_resource) {
+  counting_resource resource;
+  int v = 0;
+  {
+    auto x = mem::allocate_ref_counted<Tracked>(&resource, v);
+    EXPECT_EQ(v, 1);
+    EXPECT_EQ(resource.allocations, 1);
+
+    auto y = x;
+    EXPECT_EQ(x.use_count(), 2);
+  }
+  EXPECT_EQ(v, 2);
+  EXPECT_EQ(resource.deallocations, 1);
+  EXPECT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(allocate_ref_counted, intrusive_memory_resource) {
+  counting_resource resource;
+  int v = 0;
+  {
+    auto x = mem::allocate_ref_counted<IntrusiveTracked>(&resource, v);
+    EXPECT_EQ(v, 1);
+    EXPECT_EQ(resource.allocations, 1);
+
+    auto y = x;
+    EXPECT_EQ(x.use_count(), 2);
+    y.reset();
+    EXPECT_EQ(x.use_count(), 1);
+  }
+  EXPECT_EQ(v, 2);
+  EXPECT_EQ(resource.deallocations, 1);
+  EXPECT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(allocate_ref_counted, standard_allocator) {
+  std::allocator<int> alloc;
+
+  auto x = mem::allocate_ref_counted<int>(alloc, 12);
+  auto y = mem::allocate_ref_counted<OverAligned>(alloc);
+
+  EXPECT_EQ(*x, 12);
+  EXPECT_EQ(y->v, 3);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(y.get()) % 64, 0);
+}
+
+TEST(allocate_ref_counted, polymorphic_intrusive) {
+  struct Base : public mem::ref_counted {
+    virtual ~Base() = default;
+  };
+  struct Other {
+    virtual ~Other() = default;
+    long pad = 0;
+  };
+  // The allocator prefix is found from a Base that is not at the start of
+  // the block.
+  struct Derived final : public Other, public Base {
+    explicit Derived(int& tgt) : tgt_(tgt) {}
+    ~Derived() override {
+      tgt_ = 2;
+    }
+    int& tgt_;
+  };
+
+  counting_resource resource;
+  int v = 0;
+  {
+    mem::ref_count_ptr<Base> x =
+        mem::allocate_ref_counted<Derived>(&resource, v);
+  }
+  EXPECT_EQ(v, 2);
+  EXPECT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(allocate_ref_counted, adopting_raw_pointer) {
+  struct Obj : public mem::ref_counted {};
+
+  counting_resource resource;
+  auto x = mem::allocate_ref_counted<Obj>(&resource);
+
+  mem::ref_count_ptr<Obj> y{x.get()};
+  EXPECT_EQ(x.use_count(), 2);
+
+  x.reset();
+  y.reset();
+  EXPECT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(allocate_ref_counted, failed_construction) {
+  struct Throws : public mem::ref_counted {
+    Throws() {
+      throw std::runtime_error("nope");
+    }
+  };
+
+  counting_resource resource;
+
+  EXPECT_THROW(mem::allocate_ref_counted<Throws>(&resource),
+               std::runtime_error);
+  EXPECT_EQ(resource.allocations, 1);
+  EXPECT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(allocate_ref_counted, failed_allocator_copy) {
+  // Fail each allocator copy in turn, until creation goes through.
+  for (int failing_copy = 0;; ++failing_copy) {
+    int copies_left = failing_copy;
+    long in_use = 0;
+    int v = 0;
+    FlakyAllocator<int> alloc(copies_left, in_use);
+
+    try {
+      auto x = mem::allocate_ref_counted<IntrusiveTracked>(alloc, v);
+      EXPECT_EQ(v, 1);
+    } catch (const std::runtime_error&) {
+      EXPECT_EQ(in_use, 0);
+      EXPECT_NE(v, 1);
+      continue;
+    }
+    EXPECT_EQ(v, 2);
+    EXPECT_EQ(in_use, 0);
+    break;
+  }
+}
+
+TEST(allocate_ref_counted, arena_teardown) {
+  counting_resource upstream;
+  int v = 0;
+  int w = 0;
+  {
+    std::pmr::monotonic_buffer_resource arena(&upstream);
+    counting_resource resource(&arena);
+    {
+      auto x = mem::allocate_ref_counted<Tracked>(mem::arena_teardown,
+                                                  &resource, v);
+      auto y = mem::allocate_ref_counted<IntrusiveTracked>(
+          mem::arena_teardown, &resource, w);
+      auto z = y;
+    }
+
+    // Objects are destroyed, but their memory is never handed back.
+    EXPECT_EQ(v, 2);
+    EXPECT_EQ(w, 2);
+    EXPECT_EQ(resource.allocations, 2);
+    EXPECT_EQ(resource.deallocations, 0);
+    EXPECT_GT(upstream.bytes_in_use, 0);
+  }
+  // Until the arena goes away.
+  EXPECT_EQ(upstream.bytes_in_use, 0);
+}
+}  // namespace
@@ -0,0 +1,169 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+// Immutable string, with its characters stored right after it.
+class Str {
+ public:
+  Str(std::span<std::byte> tail, std::string_view init) {
+    std::memcpy(tail.data(), init.data(), init.size());
+    chars_ = {reinterpret_cast<const char*>(tail.data()), tail.size()};
+  }
+
+  std::string_view view() const {
+    return chars_;
+  }
+
+ private:
+  std::string_view chars_;
+};
+
+struct Packet : public mem::ref_counted {
+  using tail_element_type = std::string;
+
+  Packet(std::span<std::string> tail, std::vector<std::string>& log)
+      : fields(tail), log_(log) {}
+  Packet(const Packet&) = delete;
+  Packet(Packet&&) = delete;
+  Packet& operator=(const Packet&) = delete;
+  Packet& operator=(Packet&&) = delete;
+
+  // The tail is still alive here.
+  ~Packet() {
+    for (const auto& f : fields) {
+      log_.push_back(f);
+    }
+  }
+
+  std::span<std::string> fields;
+  std::vector<std::string>& log_;
+};
+
+struct alignas(64) Wide {
+  std::int64_t v = 7;
+};
+
+struct WideVec : public mem::ref_counted {
+  using tail_element_type = Wide;
+
+  explicit WideVec(std::span<Wide> tail) : data(tail) {}
+  std::span<Wide> data;
+};
+
+// The tail is already built when the object throws.
+struct TailThenThrows {
+  using tail_element_type = std::string;
+
+  explicit TailThenThrows(std::span<std::string> tail) {
+    tail[0] = "allocated";
+    throw std::runtime_error("nope");
+  }
+};
+
+// The tail starts right after the object, or its control block.
+template <typename T>
+bool is_contiguous(const T* obj, const void* tail) {
+  auto obj_end = reinterpret_cast<std::uintptr_t>(obj + 1);
+  auto tail_begin = reinterpret_cast<std::uintptr_t>(tail);
+  return tail_begin >= obj_end && tail_begin - obj_end < 64;
+}
+
+TEST(make_ref_counted_with_tail, single_allocation) {
+  auto str = mem::make_ref_counted_with_tail<Str>(5, "hello");
+
+  EXPECT_EQ(str->view(), "hello");
+  EXPECT_TRUE(is_contiguous(str.get(), str->view().data()));
+  EXPECT_EQ(str.use_count(), 1);
+}
+
+TEST(make_ref_counted_with_tail, intrusive_single_allocation) {
+  std::vector<std::string> log;
+  auto packet = mem::make_ref_counted_with_tail<Packet>(3, log);
+
+  EXPECT_TRUE(is_contiguous(packet.get(), packet->fields.data()));
+  EXPECT_EQ(packet.use_count(), 1);
+}
+
+TEST(make_ref_counted_with_tail, tail_is_destroyed_after_object) {
+  std::vector<std::string> log;
+  {
+    auto packet = mem::make_ref_counted_with_tail<Packet>(3, log);
+    ASSERT_EQ(packet->fields.size(), 3);
+    packet->fields[0] = "a";
+    packet->fields[1] = std::string(100, 'b');
+    packet->fields[2] = "c";
+
+    auto other = packet;
+    EXPECT_EQ(packet.use_count(), 2);
+  }
+  EXPECT_EQ(log, (std::vector<std::string>{"a", std::string(100, 'b'), "c"}));
+}
+
+TEST(make_ref_counted_with_tail, alignment) {
+  auto vec = mem::make_ref_counted_with_tail<WideVec>(4);
+
+  ASSERT_EQ(vec->data.size(), 4);
+  for (const auto& w : vec->data) {
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(&w) % 64, 0);
+    EXPECT_EQ(w.v, 7);
+  }
+  EXPECT_TRUE(is_contiguous(vec.get(), vec->data.data()));
+}
+
+TEST(make_ref_counted_with_tail, empty_tail) {
+  auto str = mem::make_ref_counted_with_tail<Str>(0, "");
+  EXPECT_TRUE(str->view().empty());
+}
+
+TEST(make_ref_counted_with_tail, polymorphic_intrusive) {
+  struct Base : public mem::ref_counted {
+    virtual ~Base() = default;
+    virtual std::size_t size() const = 0;
+  };
+  struct Derived final : public Base {
+    explicit Derived(std::span<std::byte> tail) : bytes(tail) {}
+    std::size_t size() const override {
+      return bytes.size();
+    }
+    std::span<std::byte> bytes;
+  };
+
+  mem::ref_count_ptr<Base> obj = mem::make_ref_counted_with_tail<Derived>(32);
+  EXPECT_EQ(obj->size(), 32);
+}
+
+TEST(make_ref_counted_with_tail, failed_construction) {
+  EXPECT_THROW(mem::make_ref_counted_with_tail<TailThenThrows>(2),
+               std::runtime_error);
+  EXPECT_THROW(mem::make_ref_counted_with_tail<Str>(
+                   std::numeric_limits<std::size_t>::max(), ""),
+               std::bad_array_new_length);
+}
+}  // namespace
@@ -0,0 +1,155 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+// Only keeps the parity of the key, so most keys collide.
+struct BadHash {
+  std::size_t operator()(int key) const {
+    return static_cast<std::size_t>(key & 1);
+  }
+};
+
+template <typename Map>
+std::map<int, std::string> contents(const Map& m) {
+  std::map<int, std::string> result;
+  m.for_each([&](int k, const std::string& v) { result.emplace(k, v); });
+  return result;
+}
+
+TEST(persistent_map, empty) {
+  mem::persistent_map<int, std::string> m;
+  EXPECT_TRUE(m.empty());
+  EXPECT_EQ(m.size(), 0);
+  EXPECT_EQ(m.find(1), nullptr);
+  EXPECT_FALSE(m.erase(1));
+}
+
+TEST(persistent_map, insert_and_find) {
+  mem::persistent_map<int, std::string> m;
+  EXPECT_TRUE(m.insert_or_assign(1, "one"));
+  EXPECT_TRUE(m.insert_or_assign(2, "two"));
+  EXPECT_FALSE(m.insert_or_assign(1, "uno"));
+
+  EXPECT_EQ(m.size(), 2);
+  ASSERT_NE(m.find(1), nullptr);
+  EXPECT_EQ(*m.find(1), "uno");
+  EXPECT_EQ(*m.find(2), "two");
+  EXPECT_FALSE(m.contains(3));
+}
+
+TEST(persistent_map, versions_are_independent) {
+  mem::persistent_map<int, std::string> v1;
+  for (int i = 0; i < 1000; ++i) {
+    v1.insert_or_assign(i, std::to_string(i));
+  }
+
+  auto v2 = v1;
+  v2.insert_or_assign(5, "five");
+  v2.insert_or_assign(1000, "new");
+  v2.erase(7);
+
+  EXPECT_EQ(v1.size(), 1000);
+  EXPECT_EQ(*v1.find(5), "5");
+  EXPECT_FALSE(v1.contains(1000));
+  EXPECT_EQ(*v1.find(7), "7");
+
+  EXPECT_EQ(v2.size(), 1000);
+  EXPECT_EQ(*v2.find(5), "five");
+  EXPECT_EQ(*v2.find(1000), "new");
+  EXPECT_FALSE(v2.contains(7));
+}
+
+TEST(persistent_map, unchanged_entries_are_shared) {
+  mem::persistent_map<int, std::string> v1;
+  for (int i = 0; i < 1000; ++i) {
+    v1.insert_or_assign(i, std::to_string(i));
+  }
+
+  auto v2 = v1;
+  v2.insert_or_assign(0, "zero");
+
+  int shared = 0;
+  for (int i = 0; i < 1000; ++i) {
+    shared += (v1.find(i) == v2.find(i)) ? 1 : 0;
+  }
+  EXPECT_GT(shared, 900);
+}
+
+TEST(persistent_map, unique_versions_are_updated_in_place) {
+  mem::persistent_map<int, std::string> m;
+  for (int i = 0; i < 1000; ++i) {
+    m.insert_or_assign(i, std::to_string(i));
+  }
+
+  const std::string* before = m.find(500);
+  m.insert_or_assign(500, "changed");
+  EXPECT_EQ(m.find(500), before);
+  EXPECT_EQ(*before, "changed");
+}
+
+TEST(persistent_map, collisions) {
+  mem::persistent_map<int, std::string, BadHash> m;
+  for (int i = 0; i < 100; ++i) {
+    m.insert_or_assign(i, std::to_string(i));
+  }
+  auto snapshot = m;
+
+  for (int i = 0; i < 100; i += 3) {
+    EXPECT_TRUE(m.erase(i));
+  }
+  m.insert_or_assign(1, "one");
+
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_NE(snapshot.find(i), nullptr);
+    EXPECT_EQ(*snapshot.find(i), std::to_string(i));
+    EXPECT_EQ(m.contains(i), i % 3 != 0);
+  }
+  EXPECT_EQ(*m.find(1), "one");
+  EXPECT_EQ(snapshot.size(), 100);
+  EXPECT_EQ(m.size(), 66);
+}
+
+TEST(persistent_map, erase_everything) {
+  mem::persistent_map<int, std::string> m;
+  std::map<int, std::string> expected;
+  for (int i = 0; i < 2000; ++i) {
+    m.insert_or_assign(i * 7919, std::to_string(i));
+    expected.emplace(i * 7919, std::to_string(i));
+  }
+  EXPECT_EQ(contents(m), expected);
+
+  for (int i = 0; i < 2000; i += 2) {
+    EXPECT_TRUE(m.erase(i * 7919));
+    EXPECT_FALSE(m.erase(i * 7919));
+    expected.erase(i * 7919);
+  }
+  EXPECT_EQ(contents(m), expected);
+
+  for (int i = 1; i < 2000; i += 2) {
+    EXPECT_TRUE(m.erase(i * 7919));
+  }
+  EXPECT_TRUE(m.empty());
+  EXPECT_TRUE(contents(m).empty());
+}
+}  // namespace
@@ -0,0 +1,130 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+template <typename T>
+std::vector<T> contents(const mem::persistent_vector<T>& v) {
+  std::vector<T> result;
+  v.for_each([&](const T& e) { result.push_back(e); });
+  return result;
+}
+
+TEST(persistent_vector, empty) {
+  mem::persistent_vector<int> v;
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ(v.size(), 0);
+  EXPECT_TRUE(contents(v).empty());
+}
+
+TEST(persistent_vector, push_back) {
+  mem::persistent_vector<int> v;
+  std::vector<int> expected;
+
+  // Enough to need three levels above the leaves.
+  for (int i = 0; i < 40000; ++i) {
+    v.push_back(i);
+    expected.push_back(i);
+  }
+
+  ASSERT_EQ(v.size(), expected.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(v[i], expected[i]);
+  }
+  EXPECT_EQ(contents(v), expected);
+  EXPECT_EQ(v.back(), 39999);
+}
+
+TEST(persistent_vector, pop_back) {
+  mem::persistent_vector<std::string> v;
+  for (int i = 0; i < 3000; ++i) {
+    v.push_back(std::to_string(i));
+  }
+
+  for (int i = 2999; i >= 0; --i) {
+    ASSERT_EQ(v.back(), std::to_string(i));
+    v.pop_back();
+    ASSERT_EQ(v.size(), static_cast<std::size_t>(i));
+  }
+  EXPECT_TRUE(v.empty());
+
+  v.push_back("again");
+  EXPECT_EQ(v[0], "again");
+}
+
+TEST(persistent_vector, versions_are_independent) {
+  mem::persistent_vector<std::string> v1;
+  for (int i = 0; i < 2000; ++i) {
+    v1.push_back(std::to_string(i));
+  }
+
+  auto v2 = v1;
+  v2.set(10, "ten");
+  v2.set(1999, "last");
+  v2.push_back("extra");
+
+  auto v3 = v1;
+  for (int i = 0; i < 100; ++i) {
+    v3.pop_back();
+  }
+
+  for (int i = 0; i < 2000; ++i) {
+    ASSERT_EQ(v1[i], std::to_string(i));
+  }
+  EXPECT_EQ(v1.size(), 2000);
+
+  EXPECT_EQ(v2[10], "ten");
+  EXPECT_EQ(v2[1999], "last");
+  EXPECT_EQ(v2[2000], "extra");
+  EXPECT_EQ(v2[11], "11");
+
+  EXPECT_EQ(v3.size(), 1900);
+  EXPECT_EQ(v3.back(), "1899");
+}
+
+TEST(persistent_vector, unchanged_elements_are_shared) {
+  mem::persistent_vector<int> v1;
+  for (int i = 0; i < 2000; ++i) {
+    v1.push_back(i);
+  }
+
+  auto v2 = v1;
+  v2.set(0, -1);
+
+  EXPECT_NE(&v1[0], &v2[0]);
+  EXPECT_EQ(&v1[32], &v2[32]);
+  EXPECT_EQ(&v1[1999], &v2[1999]);
+}
+
+TEST(persistent_vector, unique_versions_are_updated_in_place) {
+  mem::persistent_vector<int> v;
+  for (int i = 0; i < 2000; ++i) {
+    v.push_back(i);
+  }
+
+  const int* before = &v[100];
+  v.set(100, -1);
+  EXPECT_EQ(&v[100], before);
+  EXPECT_EQ(*before, -1);
+}
+}  // namespace
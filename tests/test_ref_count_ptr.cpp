@@ -1,312 +1,668 @@
-// Copyright 2021 Francois Chabot
-
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-
-//     http://www.apache.org/licenses/LICENSE-2.0
-
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-#include <memory>
-
-#include "abu/mem.h"
-#include "gtest/gtest.h"
-
-using namespace abu;
-
-namespace {
-TEST(ref_counted, pointer_of_arithmetic_type) {
-  const int v_1 = 5;
-  const int v_2 = 4;
-
-  mem::ref_count_ptr<int> x;
-  mem::ref_count_ptr<int> y{new int(v_1)};
-  auto z = abu::mem::make_ref_counted<int>(v_2);
-  auto w = z;
-
-  EXPECT_EQ(z.use_count(), 2);
-
-  EXPECT_EQ(*y, 5);
-  EXPECT_EQ(*z, 4);
-  swap(y, z);
-
-  EXPECT_EQ(*z, 5);
-  EXPECT_EQ(*y, 4);
-}
-
-TEST(ref_counted, object_gets_deleted) {
-  struct ObjType : public mem::ref_counted {
-    ObjType(int& tgt) : tgt_(tgt) {
-      tgt_ = 1;
-    }
-    ObjType(const ObjType&) = delete;
-    ObjType(ObjType&&) = delete;
-    ObjType& operator=(const ObjType&) = delete;
-    ObjType& operator=(ObjType&&) = delete;
-
-    ~ObjType() {
-      tgt_ = 2;
-    }
-    int& tgt_;
-  };
-
-  int v = 0;
-  {
-    mem::ref_count_ptr<ObjType> y;
-    {
-      mem::ref_count_ptr<ObjType> x = mem::make_ref_counted<ObjType>(v);
-      EXPECT_EQ(1, v);
-
-      y = x;
-    }
-    EXPECT_EQ(1, v);
-  }
-  EXPECT_EQ(2, v);
-}
-
-TEST(ref_counted, default_pointer) {
-  struct ObjType : public mem::ref_counted {
-    void foo() {}
-  };
-  ObjType* raw_ptr = nullptr;
-
-  mem::ref_count_ptr<ObjType> x;
-  mem::ref_count_ptr<ObjType> y = nullptr;
-  mem::ref_count_ptr<ObjType> z{raw_ptr};
-  mem::ref_count_ptr<ObjType> w{x};
-
-  EXPECT_EQ(x.use_count(), 0);
-  EXPECT_EQ(x, y);
-  EXPECT_EQ(x, z);
-  EXPECT_EQ(x, nullptr);
-  EXPECT_EQ(nullptr, x);
-
-#if ABU_MEM_PRECONDITIONS
-  EXPECT_DEATH(*x, "null");
-  EXPECT_DEATH(x->foo(), "null");
-#endif
-}
-
-TEST(ref_counted, init_base_from_derived_raw_ptr) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-  };
-  struct Derived : public Base {};
-
-  Derived* raw_derived = nullptr;
-  mem::ref_count_ptr<Base> dx{raw_derived};
-
-  Derived* raw_derived_2 = new Derived();
-  mem::ref_count_ptr<Base> dx2{raw_derived_2};
-
-  EXPECT_FALSE(dx);
-  EXPECT_TRUE(dx2);
-}
-
-TEST(ref_counted, move_and_copy_pointers) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-  };
-  struct Derived : public Base {};
-
-  mem::ref_count_ptr<Derived> dx = mem::make_ref_counted<Derived>();
-  mem::ref_count_ptr<Base> dxb;
-  dxb = dx;
-  EXPECT_EQ(dx, dxb);
-
-  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
-
-  auto ptr = x.get();
-
-  mem::ref_count_ptr<Base> y = std::move(x);
-  EXPECT_FALSE(x);
-  EXPECT_EQ(y.get(), ptr);
-
-  x = std::move(y);
-  EXPECT_FALSE(y);
-  EXPECT_EQ(x.get(), ptr);
-
-  y = x;
-  EXPECT_TRUE(y);
-  EXPECT_TRUE(x);
-  EXPECT_EQ(x, y);
-
-  x.reset();
-  swap(x, y);
-}
-
-TEST(ref_counted, compare) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-  };
-
-  struct Derived : public Base {};
-
-  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
-  mem::ref_count_ptr<Base> y = mem::make_ref_counted<Base>();
-  mem::ref_count_ptr<Derived> z = mem::make_ref_counted<Derived>();
-
-  EXPECT_EQ(x > y, x.get() > y.get());
-  EXPECT_EQ(x >= y, x.get() >= y.get());
-  EXPECT_EQ(x < y, x.get() < y.get());
-  EXPECT_EQ(x <= y, x.get() <= y.get());
-  EXPECT_EQ(x != y, x.get() != y.get());
-  EXPECT_EQ(x == y, x.get() == y.get());
-  EXPECT_EQ(x <=> y, x.get() <=> y.get());
-
-  EXPECT_EQ(x > z, x.get() > z.get());
-  EXPECT_EQ(x >= z, x.get() >= z.get());
-  EXPECT_EQ(x < z, x.get() < z.get());
-  EXPECT_EQ(x <= z, x.get() <= z.get());
-  EXPECT_EQ(x != z, x.get() != z.get());
-  EXPECT_EQ(x == z, x.get() == z.get());
-  EXPECT_EQ(x <=> z, x.get() <=> z.get());
-
-  Base* raw_ptr = nullptr;
-  EXPECT_EQ(x <=> nullptr, x.get() <=> raw_ptr);
-}
-
-TEST(ref_counted, polymorphic_destruction) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-  };
-
-  struct Derived final : public Base {};
-
-  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
-  mem::ref_count_ptr<Base> y = mem::make_ref_counted<Derived>();
-  mem::ref_count_ptr<Derived> z = mem::make_ref_counted<Derived>();
-}
-
-TEST(ref_counted, swappable) {
-  struct ObjType : public mem::ref_counted {};
-
-  mem::ref_count_ptr<ObjType> x = mem::make_ref_counted<ObjType>();
-  mem::ref_count_ptr<ObjType> y = mem::make_ref_counted<ObjType>();
-  auto x_b = x;
-
-  auto ptr_x = x.get();
-  auto ptr_y = y.get();
-
-  std::swap(x, y);
-
-  EXPECT_EQ(ptr_x, y.get());
-  EXPECT_EQ(ptr_y, x.get());
-
-  EXPECT_EQ(x.use_count(), 1);
-  EXPECT_EQ(y.use_count(), 2);
-}
-
-TEST(ref_counted, compatible_pointers) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-
-    virtual void foo() = 0;
-  };
-
-  struct Derived : public Base {
-    void foo() override {}
-  };
-
-  auto derived_ptr = mem::make_ref_counted<Derived>();
-  auto derived_ptr_b = derived_ptr;
-
-  mem::ref_count_ptr<Base> base_ptr_a{derived_ptr.get()};
-  mem::ref_count_ptr<Base> base_ptr_b{derived_ptr};
-  mem::ref_count_ptr<Base> base_ptr_c{base_ptr_a};
-  mem::ref_count_ptr<Base> base_ptr_moved{std::move(derived_ptr_b)};
-
-  (*derived_ptr).foo();
-  (*base_ptr_a).foo();
-  derived_ptr->foo();
-  base_ptr_a->foo();
-
-  EXPECT_FALSE(derived_ptr_b);
-
-  EXPECT_EQ(derived_ptr, base_ptr_a);
-  EXPECT_EQ(base_ptr_b, derived_ptr);
-  EXPECT_EQ(base_ptr_a, base_ptr_b);
-  EXPECT_EQ(base_ptr_a, base_ptr_moved);
-
-  EXPECT_EQ(derived_ptr.use_count(), 5);
-  EXPECT_EQ(base_ptr_a.use_count(), 5);
-  EXPECT_EQ(base_ptr_b.use_count(), 5);
-
-  mem::ref_count_ptr<Base> base_ptr_d = std::move(base_ptr_a);
-  EXPECT_EQ(base_ptr_a, nullptr);
-  EXPECT_FALSE(base_ptr_a);
-  EXPECT_EQ(base_ptr_c.use_count(), 5);
-
-  base_ptr_a = std::move(derived_ptr);
-  EXPECT_EQ(base_ptr_a.use_count(), 5);
-  EXPECT_FALSE(derived_ptr);
-
-  base_ptr_a.reset();
-  EXPECT_EQ(base_ptr_c.use_count(), 4);
-}
-
-TEST(ref_counted, can_setup_linked_list) {
-  struct node {
-    mem::ref_count_ptr<node> next;
-  };
-
-  auto ptr = mem::make_ref_counted<node>();
-  ptr->next = mem::make_ref_counted<node>();
-}
-
-TEST(ref_counted, implicitly_ref_counted) {
-  struct Base : public mem::ref_counted {
-    Base() = default;
-    Base(const Base&) = delete;
-    Base(Base&&) = delete;
-    Base& operator=(const Base&) = delete;
-    Base& operator=(Base&&) = delete;
-    virtual ~Base() = default;
-
-    virtual void foo() = 0;
-  };
-
-  struct Derived : public Base {
-    void foo() override {}
-  };
-
-  struct Unrelated {
-    void foo() {}
-  };
-
-  auto derived_ptr = mem::make_ref_counted<Derived>();
-  mem::ref_count_ptr<Base> base_ptr = derived_ptr;
-  static_assert(!std::is_convertible_v<mem::ref_count_ptr<Derived>,
-                                       mem::ref_count_ptr<Unrelated>>);
-}
-}  // namespace
\ No newline at end of file
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+// Types that come with their own embedded count.
+class Legacy {
+ public:
+  explicit Legacy(bool& destroyed) : destroyed_(destroyed) {}
+  Legacy(const Legacy&) = delete;
+  Legacy(Legacy&&) = delete;
+  Legacy& operator=(const Legacy&) = delete;
+  Legacy& operator=(Legacy&&) = delete;
+  virtual ~Legacy() {
+    destroyed_ = true;
+  }
+
+  void add_ref() {
+    count_ += 1;
+  }
+
+  void release() {
+    count_ -= 1;
+    if (count_ == 0) {
+      delete this;
+    }
+  }
+
+  int use_count() const {
+    return count_;
+  }
+
+ private:
+  int count_ = 0;
+  bool& destroyed_;
+};
+
+// Listed first, it keeps the next base away from the start of the object.
+struct Padding {
+  virtual ~Padding() = default;
+  long pad = 0;
+};
+
+// Legacy is not at the start of LegacyDerived.
+struct LegacyDerived final : public Padding, public Legacy {
+  explicit LegacyDerived(bool& destroyed) : Legacy(destroyed) {}
+};
+
+// Hooked type that counts the allocations made for it.
+struct CountedLegacy {
+  static void* operator new(std::size_t size) {
+    allocations += 1;
+    return ::operator new(size);
+  }
+
+  static void operator delete(void* ptr) noexcept {
+    ::operator delete(ptr);
+  }
+
+  void add_ref() {
+    count += 1;
+  }
+
+  void release() {
+    count -= 1;
+    if (count == 0) {
+      delete this;
+    }
+  }
+
+  static inline int allocations = 0;
+  int count = 0;
+};
+
+namespace c_api {
+struct Handle {
+  int refs = 0;
+  int value = 0;
+};
+
+void add_ref(Handle* h) {
+  h->refs += 1;
+}
+
+void release(Handle* h) {
+  h->refs -= 1;
+  if (h->refs == 0) {
+    delete h;
+  }
+}
+}  // namespace c_api
+
+TEST(ref_counted, pointer_of_arithmetic_type) {
+  const int v_1 = 5;
+  const int v_2 = 4;
+
+  mem::ref_count_ptr<int> x;
+  mem::ref_count_ptr<int> y{new int(v_1)};
+  auto z = abu::mem::make_ref_counted<int>(v_2);
+  auto w = z;
+
+  EXPECT_EQ(z.use_count(), 2);
+
+  EXPECT_EQ(*y, 5);
+  EXPECT_EQ(*z, 4);
+  swap(y, z);
+
+  EXPECT_EQ(*z, 5);
+  EXPECT_EQ(*y, 4);
+}
+
+TEST(ref_counted, layout) {
+  struct ObjType : public mem::ref_counted {
+    long v = 0;
+  };
+
+  // Unchecked builds only add the count itself.
+  static_assert(mem::borrow_tracking ||
+                sizeof(ObjType) == 2 * sizeof(long));
+}
+
+TEST(ref_counted, object_gets_deleted) {
+  struct ObjType : public mem::ref_counted {
+    ObjType(int& tgt) : tgt_(tgt) {
+      tgt_ = 1;
+    }
+    ObjType(const ObjType&) = delete;
+    ObjType(ObjType&&) = delete;
+    ObjType& operator=(const ObjType&) = delete;
+    ObjType& operator=(ObjType&&) = delete;
+
+    ~ObjType() {
+      tgt_ = 2;
+    }
+    int& tgt_;
+  };
+
+  int v = 0;
+  {
+    mem::ref_count_ptr<ObjType> y;
+    {
+      mem::ref_count_ptr<ObjType> x = mem::make_ref_counted<ObjType>(v);
+      EXPECT_EQ(1, v);
+
+      y = x;
+    }
+    EXPECT_EQ(1, v);
+  }
+  EXPECT_EQ(2, v);
+}
+
+TEST(ref_counted, default_pointer) {
+  struct ObjType : public mem::ref_counted {
+    void foo() {}
+  };
+  ObjType* raw_ptr = nullptr;
+
+  mem::ref_count_ptr<ObjType> x;
+  mem::ref_count_ptr<ObjType> y = nullptr;
+  mem::ref_count_ptr<ObjType> z{raw_ptr};
+  mem::ref_count_ptr<ObjType> w{x};
+
+  EXPECT_EQ(x.use_count(), 0);
+  EXPECT_EQ(x, y);
+  EXPECT_EQ(x, z);
+  EXPECT_EQ(x, nullptr);
+  EXPECT_EQ(nullptr, x);
+
+#if ABU_MEM_PRECONDITIONS
+  EXPECT_DEATH(*x, "null");
+  EXPECT_DEATH(x->foo(), "null");
+#endif
+}
+
+TEST(ref_counted, init_base_from_derived_raw_ptr) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+  };
+  struct Derived : public Base {};
+
+  Derived* raw_derived = nullptr;
+  mem::ref_count_ptr<Base> dx{raw_derived};
+
+  Derived* raw_derived_2 = new Derived();
+  mem::ref_count_ptr<Base> dx2{raw_derived_2};
+
+  EXPECT_FALSE(dx);
+  EXPECT_TRUE(dx2);
+}
+
+TEST(ref_counted, move_and_copy_pointers) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+  };
+  struct Derived : public Base {};
+
+  mem::ref_count_ptr<Derived> dx = mem::make_ref_counted<Derived>();
+  mem::ref_count_ptr<Base> dxb;
+  dxb = dx;
+  EXPECT_EQ(dx, dxb);
+
+  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
+
+  auto ptr = x.get();
+
+  mem::ref_count_ptr<Base> y = std::move(x);
+  EXPECT_FALSE(x);
+  EXPECT_EQ(y.get(), ptr);
+
+  x = std::move(y);
+  EXPECT_FALSE(y);
+  EXPECT_EQ(x.get(), ptr);
+
+  y = x;
+  EXPECT_TRUE(y);
+  EXPECT_TRUE(x);
+  EXPECT_EQ(x, y);
+
+  x.reset();
+  swap(x, y);
+}
+
+TEST(ref_counted, compare) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+  };
+
+  struct Derived : public Base {};
+
+  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
+  mem::ref_count_ptr<Base> y = mem::make_ref_counted<Base>();
+  mem::ref_count_ptr<Derived> z = mem::make_ref_counted<Derived>();
+
+  EXPECT_EQ(x > y, x.get() > y.get());
+  EXPECT_EQ(x >= y, x.get() >= y.get());
+  EXPECT_EQ(x < y, x.get() < y.get());
+  EXPECT_EQ(x <= y, x.get() <= y.get());
+  EXPECT_EQ(x != y, x.get() != y.get());
+  EXPECT_EQ(x == y, x.get() == y.get());
+  EXPECT_EQ(x <=> y, x.get() <=> y.get());
+
+  EXPECT_EQ(x > z, x.get() > z.get());
+  EXPECT_EQ(x >= z, x.get() >= z.get());
+  EXPECT_EQ(x < z, x.get() < z.get());
+  EXPECT_EQ(x <= z, x.get() <= z.get());
+  EXPECT_EQ(x != z, x.get() != z.get());
+  EXPECT_EQ(x == z, x.get() == z.get());
+  EXPECT_EQ(x <=> z, x.get() <=> z.get());
+
+  Base* raw_ptr = nullptr;
+  EXPECT_EQ(x <=> nullptr, x.get() <=> raw_ptr);
+}
+
+TEST(ref_counted, polymorphic_destruction) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+  };
+
+  struct Derived final : public Base {};
+
+  mem::ref_count_ptr<Base> x = mem::make_ref_counted<Base>();
+  mem::ref_count_ptr<Base> y = mem::make_ref_counted<Derived>();
+  mem::ref_count_ptr<Derived> z = mem::make_ref_counted<Derived>();
+}
+
+TEST(ref_counted, swappable) {
+  struct ObjType : public mem::ref_counted {};
+
+  mem::ref_count_ptr<ObjType> x = mem::make_ref_counted<ObjType>();
+  mem::ref_count_ptr<ObjType> y = mem::make_ref_counted<ObjType>();
+  auto x_b = x;
+
+  auto ptr_x = x.get();
+  auto ptr_y = y.get();
+
+  std::swap(x, y);
+
+  EXPECT_EQ(ptr_x, y.get());
+  EXPECT_EQ(ptr_y, x.get());
+
+  EXPECT_EQ(x.use_count(), 1);
+  EXPECT_EQ(y.use_count(), 2);
+}
+
+TEST(ref_counted, compatible_pointers) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+
+    virtual void foo() = 0;
+  };
+
+  struct Derived : public Base {
+    void foo() override {}
+  };
+
+  auto derived_ptr = mem::make_ref_counted<Derived>();
+  auto derived_ptr_b = derived_ptr;
+
+  mem::ref_count_ptr<Base> base_ptr_a{derived_ptr.get()};
+  mem::ref_count_ptr<Base> base_ptr_b{derived_ptr};
+  mem::ref_count_ptr<Base> base_ptr_c{base_ptr_a};
+  mem::ref_count_ptr<Base> base_ptr_moved{std::move(derived_ptr_b)};
+
+  (*derived_ptr).foo();
+  (*base_ptr_a).foo();
+  derived_ptr->foo();
+  base_ptr_a->foo();
+
+  EXPECT_FALSE(derived_ptr_b);
+
+  EXPECT_EQ(derived_ptr, base_ptr_a);
+  EXPECT_EQ(base_ptr_b, derived_ptr);
+  EXPECT_EQ(base_ptr_a, base_ptr_b);
+  EXPECT_EQ(base_ptr_a, base_ptr_moved);
+
+  EXPECT_EQ(derived_ptr.use_count(), 5);
+  EXPECT_EQ(base_ptr_a.use_count(), 5);
+  EXPECT_EQ(base_ptr_b.use_count(), 5);
+
+  mem::ref_count_ptr<Base> base_ptr_d = std::move(base_ptr_a);
+  EXPECT_EQ(base_ptr_a, nullptr);
+  EXPECT_FALSE(base_ptr_a);
+  EXPECT_EQ(base_ptr_c.use_count(), 5);
+
+  base_ptr_a = std::move(derived_ptr);
+  EXPECT_EQ(base_ptr_a.use_count(), 5);
+  EXPECT_FALSE(derived_ptr);
+
+  base_ptr_a.reset();
+  EXPECT_EQ(base_ptr_c.use_count(), 4);
+}
+
+TEST(ref_counted, can_setup_linked_list) {
+  struct node {
+    mem::ref_count_ptr<node> next;
+  };
+
+  auto ptr = mem::make_ref_counted<node>();
+  ptr->next = mem::make_ref_counted<node>();
+}
+
+TEST(ref_counted, implicitly_ref_counted) {
+  struct Base : public mem::ref_counted {
+    Base() = default;
+    Base(const Base&) = delete;
+    Base(Base&&) = delete;
+    Base& operator=(const Base&) = delete;
+    Base& operator=(Base&&) = delete;
+    virtual ~Base() = default;
+
+    virtual void foo() = 0;
+  };
+
+  struct Derived : public Base {
+    void foo() override {}
+  };
+
+  struct Unrelated {
+    void foo() {}
+  };
+
+  auto derived_ptr = mem::make_ref_counted<Derived>();
+  mem::ref_count_ptr<Base> base_ptr = derived_ptr;
+  static_assert(!std::is_convertible_v<mem::ref_count_ptr<Derived>,
+                                       mem::ref_count_ptr<Unrelated>>);
+}
+
+TEST(ref_counted, copied_objects_have_their_own_count) {
+  struct ObjType : public mem::ref_counted {
+    int v = 0;
+  };
+
+  auto x = mem::make_ref_counted<ObjType>();
+  auto x_b = x;
+  auto y = mem::make_ref_counted<ObjType>(*x);
+  *y = *x;
+
+  EXPECT_EQ(x.use_count(), 2);
+  EXPECT_EQ(y.use_count(), 1);
+}
+
+TEST(ref_counted, static_cast_intrusive) {
+  struct Base : public mem::ref_counted {
+    virtual ~Base() = default;
+  };
+  // Base is not at the start of Derived.
+  struct Derived : public Padding, public Base {
+    int v = 12;
+  };
+
+  mem::ref_count_ptr<Base> base = mem::make_ref_counted<Derived>();
+
+  auto copied = mem::static_ref_cast<Derived>(base);
+  EXPECT_EQ(copied->v, 12);
+  EXPECT_EQ(base.use_count(), 2);
+
+  auto moved = mem::static_ref_cast<Derived>(std::move(base));
+  EXPECT_FALSE(base);
+  EXPECT_EQ(moved, copied);
+  EXPECT_EQ(moved.use_count(), 2);
+
+  auto back = mem::static_ref_cast<Base>(std::move(moved));
+  EXPECT_EQ(back.use_count(), 2);
+  EXPECT_EQ(back.get(), static_cast<Base*>(copied.get()));
+}
+
+TEST(ref_counted, static_cast_non_intrusive) {
+  struct Base {
+    int b = 1;
+  };
+  struct Derived : public Base {
+    int d = 2;
+  };
+
+  mem::ref_count_ptr<Base> base = mem::make_ref_counted<Derived>();
+
+  auto copied = mem::static_ref_cast<Derived>(base);
+  EXPECT_EQ(copied->d, 2);
+  EXPECT_EQ(base.use_count(), 2);
+
+  auto moved = mem::static_ref_cast<Derived>(std::move(base));
+  EXPECT_FALSE(base);
+  EXPECT_EQ(moved.use_count(), 2);
+
+  mem::ref_count_ptr<Base> null_base;
+  EXPECT_FALSE(mem::static_ref_cast<Derived>(null_base));
+  EXPECT_FALSE(mem::static_ref_cast<Derived>(std::move(null_base)));
+}
+
+TEST(ref_counted, cast_moving_non_intrusive_object) {
+  struct Base {
+    virtual ~Base() = default;
+  };
+  struct Derived : public Padding, public Base {};
+
+  // The control block points at the Base, the Derived starts elsewhere.
+  mem::ref_count_ptr<Base> base{new Derived};
+  EXPECT_FALSE(mem::dynamic_ref_cast<Derived>(base));
+  EXPECT_FALSE(mem::dynamic_ref_cast<Derived>(std::move(base)));
+  ASSERT_TRUE(base);
+  EXPECT_EQ(base.use_count(), 1);
+
+  if constexpr (mem::assumptions_check_lvl == abu::base::verify) {
+    EXPECT_DEATH(mem::static_ref_cast<Derived>(base), "control block");
+  }
+}
+
+TEST(ref_counted, dynamic_cast) {
+  struct Base : public mem::ref_counted {
+    virtual ~Base() = default;
+  };
+  struct Derived : public Base {};
+  struct Unrelated : public Base {};
+
+  struct PlainBase {
+    virtual ~PlainBase() = default;
+  };
+  struct PlainDerived : public PlainBase {};
+
+  mem::ref_count_ptr<Base> base = mem::make_ref_counted<Derived>();
+
+  EXPECT_TRUE(mem::dynamic_ref_cast<Derived>(base));
+  EXPECT_FALSE(mem::dynamic_ref_cast<Unrelated>(base));
+  EXPECT_EQ(base.use_count(), 1);
+
+  // A failed cast leaves the source alone.
+  auto failed = mem::dynamic_ref_cast<Unrelated>(std::move(base));
+  EXPECT_FALSE(failed);
+  ASSERT_TRUE(base);
+  EXPECT_EQ(base.use_count(), 1);
+
+  auto derived = mem::dynamic_ref_cast<Derived>(std::move(base));
+  EXPECT_FALSE(base);
+  EXPECT_EQ(derived.use_count(), 1);
+
+  mem::ref_count_ptr<PlainBase> plain = mem::make_ref_counted<PlainDerived>();
+  auto plain_derived = mem::dynamic_ref_cast<PlainDerived>(std::move(plain));
+  EXPECT_FALSE(plain);
+  EXPECT_EQ(plain_derived.use_count(), 1);
+}
+
+TEST(ref_counted, const_cast) {
+  struct ObjType : public mem::ref_counted {
+    int v = 0;
+  };
+  struct PlainType {
+    int v = 0;
+  };
+
+  mem::ref_count_ptr<const ObjType> c = mem::make_ref_counted<ObjType>();
+  mem::ref_count_ptr<const PlainType> pc = mem::make_ref_counted<PlainType>();
+
+  auto m = mem::const_ref_cast<ObjType>(c);
+  m->v = 4;
+  EXPECT_EQ(c->v, 4);
+  EXPECT_EQ(c.use_count(), 2);
+
+  auto pm = mem::const_ref_cast<PlainType>(std::move(pc));
+  pm->v = 5;
+  EXPECT_FALSE(pc);
+  EXPECT_EQ(pm.use_count(), 1);
+
+  // Releasing through a const pointer.
+  m.reset();
+  c.reset();
+}
+
+TEST(ref_counted, foreign_member_hooks) {
+  bool destroyed = false;
+  {
+    auto obj = mem::make_ref_counted<Legacy>(destroyed);
+    EXPECT_EQ(obj.use_count(), 1);
+
+    auto other = obj;
+    EXPECT_EQ(obj->use_count(), 2);
+
+    // The count lives in the object, so owners can be made from the raw
+    // pointer at any point.
+    mem::ref_count_ptr<Legacy> from_raw{obj.get()};
+    EXPECT_EQ(obj.use_count(), 3);
+
+    mem::ref_view<Legacy> view = obj;
+    EXPECT_EQ(view.promote().use_count(), 4);
+  }
+  EXPECT_TRUE(destroyed);
+}
+
+TEST(ref_counted, foreign_hooks_allocate_no_control_block) {
+  using traits = mem::ref_count_traits<CountedLegacy>;
+
+  // make_ref_counted() allocates the object alone, not wrapped in a control
+  // block.
+  CountedLegacy::allocations = 0;
+  auto obj = mem::make_ref_counted<CountedLegacy>();
+  EXPECT_EQ(CountedLegacy::allocations, 1);
+
+  // Owners made from a raw pointer use the object as their shared state.
+  void* shared_state = traits::create_shared_state(obj.get());
+  EXPECT_EQ(shared_state, obj.get());
+  EXPECT_EQ(obj->count, 2);
+  traits::remove_ref(shared_state);
+
+  auto other = obj;
+  mem::ref_view<CountedLegacy> view = obj;
+  auto promoted = view.promote();
+  EXPECT_EQ(obj->count, 3);
+  EXPECT_EQ(CountedLegacy::allocations, 1);
+}
+
+TEST(ref_counted, foreign_adl_hooks) {
+  auto* raw = new c_api::Handle{};
+  {
+    mem::ref_count_ptr<c_api::Handle> h{raw};
+    EXPECT_EQ(raw->refs, 1);
+
+    auto other = h;
+    other->value = 3;
+    EXPECT_EQ(raw->refs, 2);
+    EXPECT_EQ(h->value, 3);
+
+    mem::ref_count_ptr<const c_api::Handle> c = h;
+    EXPECT_EQ(raw->refs, 3);
+    EXPECT_EQ(mem::const_ref_cast<c_api::Handle>(c).get(), raw);
+  }
+
+  auto made = mem::make_ref_counted<c_api::Handle>();
+  EXPECT_EQ(made->refs, 1);
+}
+
+TEST(ref_counted, foreign_hooks_conversions) {
+  bool destroyed = false;
+  {
+    auto derived = mem::make_ref_counted<LegacyDerived>(destroyed);
+    mem::ref_count_ptr<Legacy> base = derived;
+
+    EXPECT_EQ(base.get(), static_cast<Legacy*>(derived.get()));
+    EXPECT_EQ(base.use_count(), 2);
+
+    mem::ref_view<Legacy> view = derived;
+    EXPECT_EQ(view.get(), base.get());
+
+    auto back = mem::static_ref_cast<LegacyDerived>(base);
+    EXPECT_EQ(back, derived);
+    EXPECT_EQ(derived.use_count(), 3);
+
+    auto dyn = mem::dynamic_ref_cast<LegacyDerived>(std::move(base));
+    EXPECT_FALSE(base);
+    EXPECT_EQ(dyn, derived);
+    EXPECT_EQ(derived.use_count(), 3);
+
+    derived.reset();
+    back.reset();
+    EXPECT_FALSE(destroyed);
+  }
+  EXPECT_TRUE(destroyed);
+}
+
+TEST(ref_counted, no_conversion_across_traits) {
+  struct Interface {
+    virtual ~Interface() = default;
+  };
+  struct Impl : public mem::ref_counted, public Interface {};
+  struct LegacyImpl : public Legacy, public Interface {};
+
+  // Each of these would reinterpret the handle of one traits as another's.
+  static_assert(!std::is_convertible_v<mem::ref_count_ptr<Impl>,
+                                       mem::ref_count_ptr<Interface>>);
+  static_assert(!std::is_convertible_v<const mem::ref_count_ptr<Impl>&,
+                                       mem::ref_count_ptr<Interface>>);
+  static_assert(!std::is_assignable_v<mem::ref_count_ptr<Interface>&,
+                                      mem::ref_count_ptr<Impl>>);
+  static_assert(!std::is_convertible_v<mem::ref_count_ptr<LegacyImpl>,
+                                       mem::ref_count_ptr<Interface>>);
+  static_assert(!std::is_constructible_v<mem::ref_view<Interface>,
+                                         mem::ref_count_ptr<Impl>&>);
+  static_assert(!std::is_convertible_v<mem::ref_view<Impl>,
+                                       mem::ref_view<Interface>>);
+
+  static_assert(std::is_convertible_v<mem::ref_count_ptr<LegacyImpl>,
+                                      mem::ref_count_ptr<Legacy>>);
+}
+}  // namespace
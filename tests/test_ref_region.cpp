@@ -0,0 +1,251 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+struct Leaf : public mem::region_allocated {
+  int v = 0;
+};
+
+struct Tracked : public mem::region_allocated {
+  Tracked(std::vector<int>& log, int id) : log_(log), id_(id) {}
+  Tracked(const Tracked&) = delete;
+  Tracked(Tracked&&) = delete;
+  Tracked& operator=(const Tracked&) = delete;
+  Tracked& operator=(Tracked&&) = delete;
+  ~Tracked() {
+    log_.push_back(id_);
+  }
+
+  std::vector<int>& log_;
+  int id_;
+};
+
+// Parsed-document style node, linked to its siblings through views.
+struct DocNode : public mem::region_allocated {
+  explicit DocNode(int init) : v(init) {}
+
+  int v;
+  mem::ref_view<DocNode> parent;
+};
+
+struct Base : public mem::region_allocated {
+  int b = 1;
+};
+
+struct Derived : public Base {
+  int d = 2;
+};
+
+struct alignas(128) OverAligned : public mem::region_allocated {
+  int v = 3;
+};
+
+struct Huge : public mem::region_allocated {
+  std::array<std::int64_t, 20000> data = {};
+};
+
+struct Throws : public mem::region_allocated {
+  Throws() {
+    throw std::runtime_error("nope");
+  }
+};
+
+TEST(ref_region, objects_share_one_count) {
+  mem::ref_region region;
+  EXPECT_EQ(region.use_count(), 1);
+
+  auto a = region.make<Leaf>();
+  auto b = region.make<Leaf>();
+  EXPECT_EQ(region.use_count(), 3);
+  EXPECT_EQ(a.use_count(), 3);
+  EXPECT_EQ(b.use_count(), 3);
+
+  auto c = a;
+  EXPECT_EQ(b.use_count(), 4);
+
+  c.reset();
+  b.reset();
+  EXPECT_EQ(a.use_count(), 2);
+}
+
+TEST(ref_region, no_per_object_overhead) {
+  static_assert(sizeof(Leaf) == sizeof(int));
+  static_assert(sizeof(mem::ref_count_ptr<Leaf>) == sizeof(void*));
+}
+
+TEST(ref_region, memory_footprint) {
+  struct Small : public mem::region_allocated {
+    std::array<std::int64_t, 3> data = {};
+  };
+
+  mem::ref_region region;
+  EXPECT_EQ(region.reserved_bytes(), 0);
+
+  // A small cluster does not pay for a large chunk.
+  std::vector<mem::ref_count_ptr<Small>> objs;
+  for (int i = 0; i < 200; ++i) {
+    objs.push_back(region.make<Small>());
+  }
+  EXPECT_LE(region.reserved_bytes(), 2 * 200 * sizeof(Small));
+
+  // Large ones are not made of a myriad of small chunks either.
+  for (int i = 0; i < 100000; ++i) {
+    objs.push_back(region.make<Small>());
+  }
+  EXPECT_LE(region.reserved_bytes(), 2 * objs.size() * sizeof(Small));
+}
+
+TEST(ref_region, released_with_its_last_owner) {
+  std::vector<int> log;
+  mem::ref_count_ptr<Tracked> survivor;
+  {
+    mem::ref_region region;
+    auto a = region.make<Tracked>(log, 1);
+    survivor = region.make<Tracked>(log, 2);
+    auto c = region.make<Tracked>(log, 3);
+  }
+
+  // A single pointer keeps every object of the region alive.
+  EXPECT_TRUE(log.empty());
+  EXPECT_EQ(survivor->id_, 2);
+
+  survivor.reset();
+  EXPECT_EQ(log, (std::vector<int>{3, 2, 1}));
+}
+
+TEST(ref_region, linked_objects) {
+  mem::ref_count_ptr<DocNode> leaf;
+  {
+    mem::ref_region region;
+    auto root = region.make<DocNode>(0);
+    auto child = region.make<DocNode>(1);
+    child->parent = root;
+    leaf = region.make<DocNode>(2);
+    leaf->parent = child;
+  }
+
+  EXPECT_EQ(leaf->parent->parent->v, 0);
+  EXPECT_EQ(leaf.use_count(), 1);
+  leaf.reset();
+}
+
+TEST(ref_region, many_objects) {
+  mem::ref_region region;
+  std::vector<mem::ref_count_ptr<Leaf>> objs;
+
+  for (int i = 0; i < 100000; ++i) {
+    auto obj = region.make<Leaf>();
+    obj->v = i;
+    objs.push_back(std::move(obj));
+  }
+
+  for (int i = 0; i < 100000; ++i) {
+    EXPECT_EQ(objs[static_cast<std::size_t>(i)]->v, i);
+  }
+  EXPECT_EQ(region.use_count(), 100001);
+}
+
+TEST(ref_region, alignment_and_size) {
+  mem::ref_region region;
+
+  auto small = region.make<Leaf>();
+  auto aligned = region.make<OverAligned>();
+  auto huge = region.make<Huge>();
+  auto after = region.make<Leaf>();
+
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned.get()) % 128, 0);
+  EXPECT_EQ(aligned->v, 3);
+  EXPECT_EQ(huge->data.back(), 0);
+  EXPECT_EQ(huge.use_count(), 5);
+  EXPECT_EQ(after.use_count(), 5);
+}
+
+TEST(ref_region, conversions) {
+  mem::ref_region region;
+
+  mem::ref_count_ptr<Base> base = region.make<Derived>();
+  EXPECT_EQ(base->b, 1);
+  EXPECT_EQ(static_cast<Derived&>(*base).d, 2);
+
+  // Raw pointers to region objects can be turned back into owners.
+  mem::ref_count_ptr<Base> again{base.get()};
+  EXPECT_EQ(again, base);
+  EXPECT_EQ(region.use_count(), 3);
+
+  auto derived = mem::static_ref_cast<Derived>(base);
+  EXPECT_EQ(derived->d, 2);
+  EXPECT_EQ(region.use_count(), 4);
+}
+
+TEST(ref_region, failed_construction) {
+  mem::ref_region region;
+  EXPECT_THROW(region.make<Throws>(), std::runtime_error);
+  EXPECT_EQ(region.use_count(), 1);
+}
+
+TEST(ref_region, copied_regions) {
+  std::vector<int> log;
+  {
+    mem::ref_region region;
+    auto other = region;
+    EXPECT_EQ(region.use_count(), 2);
+
+    other.make<Tracked>(log, 1);
+    region = mem::ref_region{};
+    EXPECT_TRUE(log.empty());
+  }
+  EXPECT_EQ(log, std::vector<int>{1});
+}
+
+TEST(ref_region, moved_from_regions) {
+  mem::ref_region region;
+  mem::ref_region moved = std::move(region);
+
+  mem::ref_region copy = region;
+  EXPECT_EQ(copy.use_count(), 0);
+
+  moved = region;
+  EXPECT_EQ(moved.use_count(), 0);
+  EXPECT_EQ(moved.reserved_bytes(), 0);
+}
+
+TEST(ref_region, dangling_view_is_detected) {
+  if constexpr (mem::borrow_tracking) {
+    EXPECT_DEATH(
+        {
+          mem::ref_view<Leaf> view;
+          {
+            mem::ref_region region;
+            auto leaf = region.make<Leaf>();
+            view = leaf;
+          }
+          EXPECT_TRUE(view);
+        },
+        "ref_view");
+  }
+}
+}  // namespace
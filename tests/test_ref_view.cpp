@@ -0,0 +1,167 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <type_traits>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+struct Base : public mem::ref_counted {
+  Base() = default;
+  Base(const Base&) = delete;
+  Base(Base&&) = delete;
+  Base& operator=(const Base&) = delete;
+  Base& operator=(Base&&) = delete;
+  virtual ~Base() = default;
+
+  virtual int foo() const {
+    return 1;
+  }
+};
+
+struct Derived : public Base {
+  int foo() const override {
+    return 2;
+  }
+};
+
+int read_value(mem::ref_view<int> view) {
+  return *view;
+}
+
+TEST(ref_view, layout) {
+  static_assert(mem::borrow_tracking ||
+                std::is_trivially_copyable_v<mem::ref_view<int>>);
+  static_assert(mem::borrow_tracking ||
+                std::is_trivially_copyable_v<mem::ref_view<Base>>);
+  static_assert(sizeof(mem::ref_view<int>) == sizeof(int*));
+  static_assert(sizeof(mem::ref_view<Base>) == sizeof(Base*));
+}
+
+TEST(ref_view, rejects_temporaries) {
+  static_assert(!std::is_constructible_v<mem::ref_view<int>,
+                                         mem::ref_count_ptr<int>&&>);
+  static_assert(!std::is_constructible_v<mem::ref_view<Base>,
+                                         mem::ref_count_ptr<Derived>&&>);
+  static_assert(std::is_constructible_v<mem::ref_view<Base>,
+                                        mem::ref_count_ptr<Derived>&>);
+}
+
+TEST(ref_view, does_not_touch_use_count) {
+  auto owner = mem::make_ref_counted<int>(12);
+
+  mem::ref_view<int> view = owner;
+  mem::ref_view<int> view_b = view;
+
+  EXPECT_EQ(owner.use_count(), 1);
+  EXPECT_EQ(read_value(view_b), 12);
+  EXPECT_EQ(view.get(), owner.get());
+  EXPECT_TRUE(view);
+}
+
+TEST(ref_view, default_view) {
+  mem::ref_view<Base> x;
+  mem::ref_view<Base> y = nullptr;
+  mem::ref_count_ptr<Base> null_owner;
+  mem::ref_view<Base> z = null_owner;
+
+  EXPECT_FALSE(x);
+  EXPECT_EQ(x, y);
+  EXPECT_EQ(x, z);
+  EXPECT_EQ(x, nullptr);
+  EXPECT_EQ(x.get(), nullptr);
+  EXPECT_FALSE(x.promote());
+}
+
+TEST(ref_view, promote) {
+  auto owner = mem::make_ref_counted<Derived>();
+  mem::ref_view<Derived> view = owner;
+
+  mem::ref_count_ptr<Derived> promoted = view.promote();
+  EXPECT_EQ(owner.use_count(), 2);
+  EXPECT_EQ(promoted, owner);
+
+  promoted.reset();
+  EXPECT_EQ(owner.use_count(), 1);
+}
+
+TEST(ref_view, promote_keeps_object_alive) {
+  auto owner = mem::make_ref_counted<int>(3);
+  mem::ref_count_ptr<int> promoted;
+  {
+    mem::ref_view<int> view = owner;
+    promoted = view.promote();
+  }
+  owner.reset();
+
+  EXPECT_EQ(*promoted, 3);
+  EXPECT_EQ(promoted.use_count(), 1);
+}
+
+TEST(ref_view, compatible_views) {
+  auto owner = mem::make_ref_counted<Derived>();
+
+  mem::ref_view<Derived> derived_view = owner;
+  mem::ref_view<Base> base_view = derived_view;
+  mem::ref_view<Base> base_view_b = owner;
+
+  EXPECT_EQ(base_view->foo(), 2);
+  EXPECT_EQ((*base_view_b).foo(), 2);
+  EXPECT_EQ(base_view, derived_view);
+  EXPECT_EQ(base_view <=> base_view_b, std::strong_ordering::equal);
+
+  mem::ref_count_ptr<Base> promoted = base_view.promote();
+  EXPECT_EQ(owner.use_count(), 2);
+
+  static_assert(
+      !std::is_convertible_v<mem::ref_view<Base>, mem::ref_view<Derived>>);
+}
+
+TEST(ref_view, dangling_view_is_detected) {
+  if constexpr (mem::borrow_tracking) {
+    EXPECT_DEATH(
+        {
+          auto owner = mem::make_ref_counted<int>(1);
+          mem::ref_view<int> view = owner;
+          EXPECT_TRUE(view);
+          owner.reset();
+        },
+        "ref_view");
+
+    EXPECT_DEATH(
+        {
+          mem::ref_count_ptr<Base> owner = mem::make_ref_counted<Derived>();
+          mem::ref_view<Base> view = owner;
+          EXPECT_TRUE(view);
+          owner.reset();
+        },
+        "ref_view");
+  }
+}
+
+TEST(ref_view, expired_views_are_fine) {
+  auto owner = mem::make_ref_counted<Derived>();
+  {
+    mem::ref_view<Base> view = owner;
+    mem::ref_view<Base> view_b;
+    view_b = view;
+    view = view_b;
+  }
+  owner.reset();
+  EXPECT_FALSE(owner);
+}
+}  // namespace
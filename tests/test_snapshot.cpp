@@ -0,0 +1,372 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "abu/mem.h"
+#include "abu/mem/snapshot.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+struct Point {
+  int x;
+  int y;
+};
+
+struct Node : public mem::ref_counted {
+  std::string name;
+  mem::ref_count_ptr<Node> left;
+  mem::ref_count_ptr<Node> right;
+  mem::ref_count_ptr<Point> pos;
+};
+
+struct alignas(32) Wide {
+  std::int64_t v;
+};
+
+struct RegionPoint : public mem::region_allocated {
+  int x;
+  int y;
+};
+
+// Trivially copyable, but counts its own references.
+struct HookedPoint {
+  void add_ref() {
+    ++refs;
+  }
+  void release() {
+    --refs;
+  }
+
+  int refs;
+  int x;
+  int y;
+};
+}  // namespace
+
+template <>
+struct abu::mem::snapshot_traits<Node> {
+  static void save(snapshot_writer& w, const Node& n) {
+    w.write(n.name.size());
+    w.write_bytes(std::as_bytes(std::span(n.name)));
+    w.write_ref(n.left);
+    w.write_ref(n.right);
+    w.write_ref(n.pos);
+  }
+
+  static ref_count_ptr<Node> load(snapshot_reader& r) {
+    auto result = make_ref_counted<Node>();
+    auto name = r.read_bytes(r.read<std::size_t>());
+    result->name.assign(reinterpret_cast<const char*>(name.data()),
+                        name.size());
+    r.read_ref(result->left);
+    r.read_ref(result->right);
+    r.read_ref(result->pos);
+    return result;
+  }
+};
+
+namespace {
+mem::ref_count_ptr<Node> make_node(std::string name,
+                                   mem::ref_count_ptr<Node> left = nullptr,
+                                   mem::ref_count_ptr<Node> right = nullptr,
+                                   mem::ref_count_ptr<Point> pos = nullptr) {
+  auto result = mem::make_ref_counted<Node>();
+  result->name = std::move(name);
+  result->left = std::move(left);
+  result->right = std::move(right);
+  result->pos = std::move(pos);
+  return result;
+}
+
+// root -> a -> shared
+//      -> b -> shared
+// with a and b sharing the same position.
+mem::ref_count_ptr<Node> make_diamond() {
+  auto pos = mem::make_ref_counted<Point>(Point{3, 4});
+  auto shared = make_node("shared");
+  auto a = make_node("a", shared, nullptr, pos);
+  auto b = make_node("b", nullptr, shared, pos);
+  return make_node("root", a, b);
+}
+
+static_assert(mem::snapshot_node<Point>);
+static_assert(std::is_trivially_copyable_v<RegionPoint>);
+static_assert(!mem::snapshot_node<RegionPoint>);
+static_assert(std::is_trivially_copyable_v<HookedPoint>);
+static_assert(!mem::in_place_snapshot_node<HookedPoint>);
+
+TEST(snapshot, round_trip) {
+  auto data = mem::save_snapshot(make_diamond());
+  auto snap = mem::snapshot::copy_of(data);
+
+  auto root = snap.root<Node>();
+  ASSERT_TRUE(root);
+  EXPECT_EQ(root->name, "root");
+  EXPECT_EQ(root->left->name, "a");
+  EXPECT_EQ(root->right->name, "b");
+  EXPECT_EQ(root->left->left->name, "shared");
+  EXPECT_FALSE(root->left->right);
+  EXPECT_EQ(root->left->pos->x, 3);
+  EXPECT_EQ(root->left->pos->y, 4);
+}
+
+TEST(snapshot, sharing_is_preserved) {
+  auto data = mem::save_snapshot(make_diamond());
+
+  mem::ref_count_ptr<Node> root;
+  {
+    auto snap = mem::snapshot::copy_of(data);
+    root = snap.root<Node>();
+
+    EXPECT_EQ(root->left->left, root->right->right);
+    EXPECT_EQ(root->left->pos, root->right->pos);
+  }
+
+  // Once the snapshot is gone, only the graph holds shared nodes.
+  EXPECT_EQ(root->left->left.use_count(), 2);
+  EXPECT_EQ(root->left->pos.use_count(), 2);
+}
+
+TEST(snapshot, shared_nodes_are_written_once) {
+  auto leaf = make_node(std::string(1000, 'x'));
+  auto once = mem::save_snapshot(make_node("root", leaf, nullptr));
+  auto twice = mem::save_snapshot(make_node("root", leaf, leaf));
+
+  EXPECT_LT(twice.size(), once.size() + 100);
+}
+
+TEST(snapshot, in_place_root) {
+  auto data = mem::save_snapshot(mem::make_ref_counted<Wide>(Wide{42}));
+  auto snap = mem::snapshot::copy_of(data);
+
+  auto root = snap.root<Wide>();
+  EXPECT_EQ(root->v, 42);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(root.get()) % alignof(Wide), 0);
+
+  // The snapshot keeps the root, so a second request returns the same node.
+  auto again = snap.root<Wide>();
+  EXPECT_EQ(root, again);
+  EXPECT_EQ(root.use_count(), 3);
+}
+
+TEST(snapshot, in_place_nodes_outlive_snapshot) {
+  mem::ref_count_ptr<Point> pos;
+  {
+    auto data = mem::save_snapshot(mem::make_ref_counted<Point>(Point{1, 2}));
+    auto snap = mem::snapshot::copy_of(data);
+    pos = snap.root<Point>();
+  }
+  EXPECT_EQ(pos->x, 1);
+  EXPECT_EQ(pos->y, 2);
+  EXPECT_EQ(pos.use_count(), 1);
+}
+
+TEST(snapshot, in_place_padding_is_cleared) {
+  auto save_with_padding = [](unsigned char fill) {
+    auto node = mem::make_ref_counted<Wide>();
+    std::memset(node.get(), fill, sizeof(Wide));
+    node->v = 42;
+    return mem::save_snapshot(node);
+  };
+
+  EXPECT_EQ(save_with_padding(0x00), save_with_padding(0xff));
+}
+
+TEST(snapshot, null_root) {
+  auto data = mem::save_snapshot(mem::ref_count_ptr<Node>{});
+  auto snap = mem::snapshot::copy_of(data);
+
+  EXPECT_FALSE(snap.root<Node>());
+}
+
+TEST(snapshot, relocatable) {
+  auto data = mem::save_snapshot(make_diamond());
+
+  // Shift the bytes around in memory before loading them.
+  std::vector<std::byte> elsewhere(data.size() + 7);
+  std::copy(data.begin(), data.end(), elsewhere.begin() + 7);
+
+  auto snap = mem::snapshot::copy_of(std::span(elsewhere).subspan(7));
+  EXPECT_EQ(snap.root<Node>()->right->right->name, "shared");
+}
+
+TEST(snapshot, long_chain) {
+  constexpr int length = 1'000'000;
+
+  mem::ref_count_ptr<Node> head;
+  for (int i = 0; i < length; ++i) {
+    head = make_node("", std::move(head));
+  }
+  head->name = "head";
+
+  auto data = mem::save_snapshot(head);
+  auto snap = mem::snapshot::copy_of(data);
+  auto loaded = snap.root<Node>();
+  EXPECT_EQ(loaded->name, "head");
+
+  int count = 0;
+  for (const Node* n = loaded.get(); n; n = n->left.get()) {
+    ++count;
+  }
+  EXPECT_EQ(count, length);
+
+  // Tear the chains down from the front, as recursive destruction would run
+  // out of stack.
+  for (auto* chain : {&head, &loaded}) {
+    while (*chain) {
+      auto next = std::move((*chain)->left);
+      *chain = std::move(next);
+    }
+  }
+}
+
+TEST(snapshot, cycle) {
+  auto a = make_node("a");
+  auto b = make_node("b", a);
+  a->left = b;
+  a->right = a;
+
+  auto data = mem::save_snapshot(a);
+  auto snap = mem::snapshot::copy_of(data);
+  auto loaded = snap.root<Node>();
+
+  ASSERT_TRUE(loaded);
+  EXPECT_EQ(loaded->name, "a");
+  EXPECT_EQ(loaded->left->name, "b");
+  EXPECT_EQ(loaded->left->left, loaded);
+  EXPECT_EQ(loaded->right, loaded);
+
+  for (auto* node : {&a, &loaded}) {
+    (*node)->left->left.reset();
+    (*node)->right.reset();
+  }
+}
+
+TEST(snapshot, rejects_garbage) {
+  std::vector<std::byte> garbage(128, std::byte{0x42});
+  EXPECT_THROW(mem::snapshot::copy_of(garbage), std::runtime_error);
+
+  std::vector<std::byte> tiny(4);
+  EXPECT_THROW(mem::snapshot::copy_of(tiny), std::runtime_error);
+}
+
+std::uint64_t read_u64(const std::vector<std::byte>& data, std::size_t pos) {
+  std::uint64_t result;
+  std::memcpy(&result, data.data() + pos, sizeof(result));
+  return result;
+}
+
+std::vector<std::byte> patched(std::vector<std::byte> data,
+                               std::size_t pos,
+                               std::uint64_t value) {
+  std::memcpy(data.data() + pos, &value, sizeof(value));
+  return data;
+}
+
+TEST(snapshot, rejects_corrupt_contents) {
+  const auto data = mem::save_snapshot(make_diamond());
+
+  constexpr std::size_t size_pos = 16;
+  constexpr std::size_t root_pos = 24;
+  constexpr std::size_t shared_count_pos = 32;
+  const std::uint64_t root = read_u64(data, root_pos);
+
+  auto load_root = [](const std::vector<std::byte>& bytes) {
+    auto snap = mem::snapshot::copy_of(bytes);
+    return snap.root<Node>();
+  };
+
+  // References outside of the snapshot, including ones that would overflow.
+  EXPECT_THROW(load_root(patched(data, root_pos, std::uint64_t{1} << 40)),
+               std::runtime_error);
+  EXPECT_THROW(load_root(patched(data, root_pos, ~std::uint64_t{0} - 7)),
+               std::runtime_error);
+  EXPECT_THROW(load_root(patched(data, root_pos, 8)), std::runtime_error);
+
+  // Misaligned record.
+  EXPECT_THROW(load_root(patched(data, root_pos, root + 8)),
+               std::runtime_error);
+
+  // Record whose payload runs past the end.
+  EXPECT_THROW(load_root(patched(data, root, ~std::uint64_t{0})),
+               std::runtime_error);
+
+  // Bad shared slot.
+  EXPECT_THROW(load_root(patched(data, root + 8, 1000)), std::runtime_error);
+
+  // Reading past the end of a node's payload.
+  EXPECT_THROW(load_root(patched(data, root + 16, std::uint64_t{1} << 40)),
+               std::runtime_error);
+
+  // Header claiming more than there is.
+  EXPECT_THROW(load_root(patched(data, size_pos, data.size() + 1)),
+               std::runtime_error);
+  EXPECT_THROW(
+      load_root(patched(data, shared_count_pos, std::uint64_t{1} << 60)),
+      std::runtime_error);
+
+  // Unshared node referring to itself.
+  auto single = mem::save_snapshot(make_node(""));
+  auto single_root = read_u64(single, root_pos);
+  constexpr std::size_t left_pos = 24;
+  auto looped = patched(single, single_root + left_pos, single_root);
+  EXPECT_THROW(load_root(looped), std::runtime_error);
+
+  // In-place node of the wrong size.
+  auto point = mem::save_snapshot(mem::make_ref_counted<Point>(Point{1, 2}));
+  auto point_root = read_u64(point, root_pos);
+  auto bad_point = patched(point, point_root, sizeof(Point) + 1);
+  EXPECT_THROW(mem::snapshot::copy_of(bad_point).root<Point>(),
+               std::runtime_error);
+}
+
+TEST(snapshot, mapped_file) {
+  auto path = std::filesystem::temp_directory_path() /
+              "abu_mem_test_snapshot.bin";
+  mem::save_snapshot(make_diamond(), path);
+
+  mem::ref_count_ptr<Node> root;
+  {
+    auto snap = mem::snapshot::map_file(path);
+    root = snap.root<Node>();
+
+    // In-place nodes can be modified without touching the file.
+    root->left->pos->x = 12;
+    EXPECT_EQ(root->right->pos->x, 12);
+
+    auto other = mem::snapshot::map_file(path);
+    EXPECT_EQ(other.root<Node>()->left->pos->x, 3);
+  }
+  EXPECT_EQ(root->left->left->name, "shared");
+  EXPECT_EQ(root->left->pos->y, 4);
+
+  root.reset();
+  std::filesystem::remove(path);
+}
+
+TEST(snapshot, missing_file) {
+  EXPECT_THROW(mem::snapshot::map_file("/this/does/not/exist.snap"),
+               std::system_error);
+}
+}  // namespace
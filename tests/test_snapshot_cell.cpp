@@ -0,0 +1,145 @@
+// Copyright 2021 Francois Chabot
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "abu/mem.h"
+#include "gtest/gtest.h"
+
+using namespace abu;
+
+namespace {
+
+std::atomic<int> live_versions = 0;
+
+// Both values are always equal in a published version.
+struct Version : public mem::ref_counted {
+  explicit Version(int init) : a(init), b(init) {
+    live_versions += 1;
+  }
+  Version(const Version&) = delete;
+  Version(Version&&) = delete;
+  Version& operator=(const Version&) = delete;
+  Version& operator=(Version&&) = delete;
+  ~Version() {
+    a = -1;
+    live_versions -= 1;
+  }
+
+  int a;
+  int b;
+};
+
+TEST(snapshot_cell, read_and_publish) {
+  {
+    mem::snapshot_cell<Version> cell{mem::make_ref_counted<Version>(1)};
+    {
+      auto v = cell.read();
+      EXPECT_EQ(v->a, 1);
+    }
+
+    cell.publish(mem::make_ref_counted<Version>(2));
+    EXPECT_EQ(cell.read()->a, 2);
+
+    // The previous version is gone by the time publish() returns.
+    EXPECT_EQ(live_versions, 1);
+  }
+  EXPECT_EQ(live_versions, 0);
+}
+
+TEST(snapshot_cell, empty_cell) {
+  mem::snapshot_cell<Version> cell;
+  EXPECT_FALSE(cell.read());
+
+  cell.publish(mem::make_ref_counted<Version>(3));
+  EXPECT_TRUE(cell.read());
+
+  cell.publish(nullptr);
+  EXPECT_FALSE(cell.read());
+  EXPECT_EQ(live_versions, 0);
+}
+
+TEST(snapshot_cell, update) {
+  mem::snapshot_cell<Version> cell{mem::make_ref_counted<Version>(1)};
+
+  cell.update([](const mem::ref_count_ptr<Version>& current) {
+    return mem::make_ref_counted<Version>(current->a + 1);
+  });
+  EXPECT_EQ(cell.read()->b, 2);
+}
+
+TEST(snapshot_cell, readers_keep_old_version_alive) {
+  mem::snapshot_cell<Version> cell{mem::make_ref_counted<Version>(1)};
+
+  std::atomic<bool> published = false;
+  std::thread writer;
+  {
+    auto v = cell.read();
+    writer = std::thread([&] {
+      cell.publish(mem::make_ref_counted<Version>(2));
+      published = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(published);
+    EXPECT_EQ(v->a, 1);
+  }
+  writer.join();
+
+  EXPECT_TRUE(published);
+  EXPECT_EQ(cell.read()->a, 2);
+  EXPECT_EQ(live_versions, 1);
+}
+
+TEST(snapshot_cell, concurrent_readers) {
+  constexpr int version_count = 500;
+
+  {
+    mem::snapshot_cell<Version> cell{mem::make_ref_counted<Version>(0), 4};
+    std::atomic<bool> done = false;
+    std::atomic<int> torn_reads = 0;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 8; ++i) {
+      readers.emplace_back([&] {
+        int last = 0;
+        while (!done) {
+          auto v = cell.read();
+          if (v->a != v->b || v->a < last) {
+            torn_reads += 1;
+          }
+          last = v->a;
+        }
+      });
+    }
+
+    for (int i = 1; i <= version_count; ++i) {
+      cell.publish(mem::make_ref_counted<Version>(i));
+    }
+    done = true;
+
+    for (auto& r : readers) {
+      r.join();
+    }
+
+    EXPECT_EQ(torn_reads, 0);
+    EXPECT_EQ(cell.read()->a, version_count);
+    EXPECT_EQ(live_versions, 1);
+  }
+  EXPECT_EQ(live_versions, 0);
+}
+}  // namespace